@@ -17,10 +17,13 @@
 
 #include "lvgl/lvgl.h"
 
+#include "vx_capture.h"
 #include "vx_config.h"
 #include "vx_models.h"
 #include "vx_network.h"
+#include "vx_sampler.h"
 #include "vx_stats.h"
+#include "vx_telemetry.h"
 #include "vx_utils.h"
 #include "vx_view.h"
 
@@ -28,6 +31,12 @@
 Selector selector;
 pthread_mutex_t main_mutex;
 InterfaceCollection* interface_collection;
+// No display, rates are printed on the console
+bool headless = false;
+// Newest sample handed over by the sampler thread
+static Sample latest_sample;
+// SIGUSR1 saves the capture, the only way to do it without a keyboard
+static volatile sig_atomic_t capture_requested = 0;
 
 void setup_filesystems() {
     if (mount("none", "/dev", "devtmpfs", 0, NULL) != 0) {
@@ -53,12 +62,19 @@ void setup_filesystems() {
 }
 
 void cleanup(int sig) {
+    sampler_stop();
+    sample_free(&latest_sample);
     if (interface_collection)
         xdp_cleanup(interface_collection);
+    capture_cleanup();
     rtnl_cleanup();
     exit(EXIT_FAILURE);
 }
 
+void request_capture(int sig) {
+    capture_requested = 1;
+}
+
 int main(int argc, char const *argv[]) {
     struct timespec   now;
     struct itimerspec new_value;
@@ -70,20 +86,26 @@ int main(int argc, char const *argv[]) {
 #ifndef VX_DEV
     setup_filesystems();
 #endif
+    headless = config_headless();
 
     // Set up signal handlers for cleanup
     signal(SIGINT,  cleanup);
     signal(SIGTERM, cleanup);
     signal(SIGKILL, cleanup);
+    signal(SIGUSR1, request_capture);
 
-    lv_init();
+    if (!headless) {
+        lv_init();
 
-    // Linux display device init
-    lv_display_t * disp = lv_linux_fbdev_create();
-    lv_linux_fbdev_set_file(disp, "/dev/fb0");
+        // Linux display device init
+        lv_display_t * disp = lv_linux_fbdev_create();
+        lv_linux_fbdev_set_file(disp, "/dev/fb0");
 
-    // Create GUI background
-    create_background();
+        // Create GUI background
+        create_background();
+    } else {
+        printf("Headless mode, rates on the console\n");
+    }
 
     // Initialize objects
     interface_collection = init_interfaces();
@@ -112,11 +134,16 @@ int main(int argc, char const *argv[]) {
         cleanup(0);
     }
 
+    // Counters are read by their own thread, at their own period
+    if (sampler_start(interface_collection, cpu_collection, memory_collection) < 0
+        || sample_alloc(&latest_sample) < 0)
+        cleanup(0);
+
     // Init selector on first interface
     selector.selected = (void*)interface_collection->input_head;
     selector.display_mode = VX_DISPLAY_BYTES;
 
-    if (interfaces_chart_change_visibility()) {
+    if (!headless && interfaces_chart_change_visibility()) {
         cleanup(0);
     }
 
@@ -144,14 +171,18 @@ int main(int argc, char const *argv[]) {
 
     // Input listener thread
     pthread_t evdev_thread;
-    pthread_create(&evdev_thread, NULL, select_interface, NULL);
+    if (!headless)
+        pthread_create(&evdev_thread, NULL, select_interface, NULL);
 
     // Main loop
     size_t tick = 0;
+    bool   sampled = false;
     while(1) {
 
 #ifdef VX_DEV
-        if (active_tty()) {
+        if (headless) {
+            // Nothing to show or hide
+        } else if (active_tty()) {
             lv_obj_remove_flag(lv_scr_act(), LV_OBJ_FLAG_HIDDEN);
         } else {
             lv_obj_add_flag(lv_scr_act(), LV_OBJ_FLAG_HIDDEN);
@@ -159,26 +190,48 @@ int main(int argc, char const *argv[]) {
         }
 #endif
 
+        // Drain the sampler every frame, its newest sample feeds the charts
+        int samples = sampler_consume(&latest_sample);
+        if (samples < 0)
+            cleanup(0);
+        sampled |= samples > 0;
+
         if (tick%10 == 0) {
             // Check interfaces up/down
             interfaces_refresh();
 
-            // Update charts
-            pthread_mutex_lock(&main_mutex);
-            if (interfaces_chart_update() < 0)
-                cleanup(0);
-            pthread_mutex_unlock(&main_mutex);
-
-            if (cpus_chart_update(cpu_collection) < 0)
-                cleanup(0);
-
-            if (memory_chart_update(memory_collection) < 0)
-                cleanup(0);
+            // Update charts, or print the rates when headless
+            if (sampled) {
+                pthread_mutex_lock(&main_mutex);
+                if (apply_interfaces_sample(interface_collection, &latest_sample) < 0
+                    || (!headless && interfaces_chart_update() < 0))
+                    cleanup(0);
+                pthread_mutex_unlock(&main_mutex);
+
+                apply_cpus_sample(cpu_collection, &latest_sample);
+                apply_memory_sample(memory_collection, &latest_sample);
+                if (headless) {
+                    telemetry_print(interface_collection, &latest_sample);
+                } else if (cpus_chart_update(cpu_collection) < 0
+                    || memory_chart_update(memory_collection) < 0) {
+                    cleanup(0);
+                }
+                sampled = false;
+            }
             klogctl(5, NULL, NULL);
         }
 
         pthread_mutex_lock(&main_mutex);
-        lv_timer_handler();
+        if (capture_poll() < 0)
+            cleanup(0);
+        if (capture_requested) {
+            capture_requested = 0;
+            capture_dump(VX_CAPTURE_FILE);
+        }
+        if (tick%10 == 0)
+            capture_view_update();
+        if (!headless)
+            lv_timer_handler();
         pthread_mutex_unlock(&main_mutex);
 
         s = read(fd, &exp, sizeof(uint64_t));
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <linux/types.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <bpf/libbpf.h>
+
+#include "lvgl/lvgl.h"
+
+#include "vx_config.h"
+#include "vx_models.h"
+#include "vx_capture.h"
+
+extern InterfaceCollection* interface_collection;
+extern bool headless;
+
+// One captured frame, kept until overwritten by a newer one
+struct capture_slot {
+    __u64 timestamp; // CLOCK_REALTIME ns
+    __u32 interface; // Input position, pcapng interface id
+    __u32 vlan_id;
+    __u32 len;
+    __u32 caplen;
+    __u8  data[VX_CAPTURE_SNAPLEN];
+};
+
+static struct ring_buffer*  capture_rb = NULL;
+static struct capture_slot* slots      = NULL;
+static size_t slot_count = 0;
+static size_t slot_head  = 0; // Next slot written
+static size_t slot_used  = 0;
+static __s64  realtime_offset; // CLOCK_REALTIME - CLOCK_MONOTONIC
+static lv_obj_t* capture_label = NULL;
+
+static int interface_position(__u32 ifindex) {
+    int i = 0;
+    for (Interface* iface = interface_collection->input_head; iface; iface = iface->next, i++)
+        if (iface->if_index == (int)ifindex)
+            return i;
+    return -1;
+}
+
+static int handle_record(void *ctx, void *data, size_t size) {
+    const struct capture_record *record = data;
+    if (size < sizeof(*record))
+        return 0;
+
+    struct capture_slot *slot = &slots[slot_head];
+    int position = interface_position(record->ifindex);
+    slot->timestamp = record->timestamp + realtime_offset;
+    slot->interface = position < 0 ? 0 : position;
+    slot->vlan_id   = record->vlan_id;
+    slot->len       = record->len;
+    slot->caplen    = record->caplen > VX_CAPTURE_SNAPLEN ? VX_CAPTURE_SNAPLEN : record->caplen;
+    memcpy(slot->data, record->data, slot->caplen);
+
+    slot_head = (slot_head + 1) % slot_count;
+    if (slot_used < slot_count)
+        slot_used++;
+    return 0;
+}
+
+int capture_init(int capture_map_fd, size_t ring_size) {
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME,  &real);
+    realtime_offset = (real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+
+    slot_count = ring_size / sizeof(struct capture_slot);
+    slots = calloc(slot_count, sizeof(struct capture_slot));
+    if (!slots) {
+        perror("Error: capture ring allocation failed");
+        return -1;
+    }
+
+    capture_rb = ring_buffer__new(capture_map_fd, handle_record, NULL, NULL);
+    if (!capture_rb) {
+        perror("Error: ring_buffer__new failed");
+        free(slots);
+        slots = NULL;
+        return -1;
+    }
+
+    if (headless) {
+        printf("Capture ring of %zu frames\n", slot_count);
+        return 0;
+    }
+    capture_label = lv_label_create(lv_scr_act());
+    if (!capture_label) {
+        perror("lv_label_create allocation failed");
+        capture_cleanup();
+        return -1;
+    }
+    lv_obj_set_size(capture_label, 800, 16 * (VX_CAPTURE_SUMMARY + 1) + 8);
+    lv_obj_set_pos(capture_label, 0, 200);
+    lv_obj_set_style_bg_color(capture_label, VX_GREY_COLOR, 0);
+    lv_obj_set_style_bg_opa(capture_label, LV_OPA_COVER, 0);
+    lv_obj_set_style_pad_all(capture_label, 4, 0);
+    lv_obj_set_style_text_font(capture_label, &lv_font_montserrat_14, 0);
+    lv_obj_set_style_text_color(capture_label, VX_WHITE_COLOR, 0);
+    lv_obj_add_flag(capture_label, LV_OBJ_FLAG_HIDDEN);
+
+    printf("Capture ring of %zu frames\n", slot_count);
+    return 0;
+}
+
+int capture_poll() {
+    if (!capture_rb)
+        return 0;
+    int ret = ring_buffer__consume(capture_rb);
+    if (ret < 0) {
+        perror("Error: ring_buffer__consume failed");
+        return -1;
+    }
+    return ret;
+}
+
+// pcapng blocks, see draft-ietf-opsawg-pcapng
+static int write_block(FILE *file, __u32 type, const void *body, __u32 body_len) {
+    static const __u8 padding[4] = {0};
+    __u32 pad = (4 - body_len % 4) % 4;
+    __u32 total = 12 + body_len + pad;
+    if (fwrite(&type, 4, 1, file) != 1
+        || fwrite(&total, 4, 1, file) != 1
+        || (body_len && fwrite(body, body_len, 1, file) != 1)
+        || (pad && fwrite(padding, pad, 1, file) != 1)
+        || fwrite(&total, 4, 1, file) != 1)
+        return -1;
+    return 0;
+}
+
+int capture_dump(const char *path) {
+    if (!slots) {
+        fprintf(stderr, "Error: no capture configured\n");
+        return -1;
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror("Error: opening capture file failed");
+        return -1;
+    }
+
+    // Section Header Block
+    struct __attribute__((packed)) {
+        __u32 magic;
+        __u16 major;
+        __u16 minor;
+        __s64 section_length;
+    } shb = { 0x1A2B3C4D, 1, 0, -1 };
+    int ret = write_block(file, 0x0A0D0D0A, &shb, sizeof(shb));
+
+    // Interface Description Block per input, with its if_name option
+    for (Interface* iface = interface_collection->input_head; iface && ret == 0; iface = iface->next) {
+        __u8 idb[8 + 4 + IFNAMSIZ + 4] = {0};
+        __u16 name_len = strnlen(iface->interface_name, IFNAMSIZ);
+        __u16 name_option = 2;
+        __u16 linktype = 1; // LINKTYPE_ETHERNET
+        __u32 snaplen = VX_CAPTURE_SNAPLEN;
+        memcpy(idb,      &linktype,    2);
+        memcpy(idb + 4,  &snaplen,     4);
+        memcpy(idb + 8,  &name_option, 2);
+        memcpy(idb + 10, &name_len,    2);
+        memcpy(idb + 12, iface->interface_name, name_len);
+        // opt_endofopt follows the padded name
+        ret = write_block(file, 0x00000001, idb, 12 + ((name_len + 3) & ~3) + 4);
+    }
+
+    // Enhanced Packet Blocks, oldest first, timestamps in microseconds
+    for (size_t i = 0; i < slot_used && ret == 0; i++) {
+        const struct capture_slot *slot = &slots[(slot_head + slot_count - slot_used + i) % slot_count];
+        __u8 epb[20 + VX_CAPTURE_SNAPLEN];
+        __u64 timestamp = slot->timestamp / 1000;
+        __u32 header[5] = {
+            slot->interface,
+            (__u32)(timestamp >> 32),
+            (__u32)timestamp,
+            slot->caplen,
+            slot->len
+        };
+        memcpy(epb, header, sizeof(header));
+        memcpy(epb + sizeof(header), slot->data, slot->caplen);
+        ret = write_block(file, 0x00000006, epb, sizeof(header) + slot->caplen);
+    }
+
+    if (fclose(file) != 0 || ret < 0) {
+        perror("Error: writing capture file failed");
+        return -1;
+    }
+    printf("Capture of %zu frames written to %s\n", slot_used, path);
+    return 0;
+}
+
+// "src > dst proto" of a captured frame, skipping its VLAN tags
+static void describe_frame(const struct capture_slot *slot, char *buf, size_t size) {
+    const __u8 *data = slot->data;
+    __u32 offset = 12;
+    __u16 proto;
+
+    snprintf(buf, size, "-");
+    if (slot->caplen < offset + 2)
+        return;
+    memcpy(&proto, data + offset, 2);
+    offset += 2;
+    while ((proto == htons(ETH_P_8021Q) || proto == htons(ETH_P_8021AD)) && slot->caplen >= offset + 4) {
+        memcpy(&proto, data + offset + 2, 2);
+        offset += 4;
+    }
+
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    __u8 l4;
+    if (proto == htons(ETH_P_IP) && slot->caplen >= offset + sizeof(struct iphdr)) {
+        const struct iphdr *ip = (const void *)(data + offset);
+        inet_ntop(AF_INET, &ip->saddr, src, sizeof(src));
+        inet_ntop(AF_INET, &ip->daddr, dst, sizeof(dst));
+        l4 = ip->protocol;
+    } else if (proto == htons(ETH_P_IPV6) && slot->caplen >= offset + sizeof(struct ipv6hdr)) {
+        const struct ipv6hdr *ip6 = (const void *)(data + offset);
+        inet_ntop(AF_INET6, &ip6->saddr, src, sizeof(src));
+        inet_ntop(AF_INET6, &ip6->daddr, dst, sizeof(dst));
+        l4 = ip6->nexthdr;
+    } else {
+        snprintf(buf, size, "ethertype 0x%04x", ntohs(proto));
+        return;
+    }
+
+    switch (l4) {
+    case IPPROTO_TCP:    snprintf(buf, size, "%s > %s tcp", src, dst);  break;
+    case IPPROTO_UDP:    snprintf(buf, size, "%s > %s udp", src, dst);  break;
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6: snprintf(buf, size, "%s > %s icmp", src, dst); break;
+    default:             snprintf(buf, size, "%s > %s proto %u", src, dst, l4);
+    }
+}
+
+void capture_view_toggle() {
+    if (!capture_label)
+        return;
+    if (lv_obj_has_flag(capture_label, LV_OBJ_FLAG_HIDDEN)) {
+        lv_obj_remove_flag(capture_label, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_move_foreground(capture_label);
+        capture_view_update();
+    } else {
+        lv_obj_add_flag(capture_label, LV_OBJ_FLAG_HIDDEN);
+    }
+}
+
+void capture_view_update() {
+    if (!capture_label || lv_obj_has_flag(capture_label, LV_OBJ_FLAG_HIDDEN))
+        return;
+
+    char text[(VX_CAPTURE_SNAPLEN + 1) * (VX_CAPTURE_SUMMARY + 1)];
+    size_t shown = slot_used < VX_CAPTURE_SUMMARY ? slot_used : VX_CAPTURE_SUMMARY;
+    int n = snprintf(text, sizeof(text), "Capture: %zu/%zu frames, [w] save to "VX_CAPTURE_FILE, slot_used, slot_count);
+
+    // Newest first
+    for (size_t i = 0; i < shown && n < (int)sizeof(text); i++) {
+        const struct capture_slot *slot = &slots[(slot_head + slot_count - 1 - i) % slot_count];
+        time_t seconds = slot->timestamp / 1000000000ULL;
+        struct tm tm;
+        char description[2 * INET6_ADDRSTRLEN + 16];
+        const char *name = "?";
+        int position = 0;
+
+        for (Interface* iface = interface_collection->input_head; iface; iface = iface->next, position++)
+            if (position == (int)slot->interface)
+                name = iface->interface_name;
+        localtime_r(&seconds, &tm);
+        describe_frame(slot, description, sizeof(description));
+        n += snprintf(text + n, sizeof(text) - n, "\n%02d:%02d:%02d.%06llu  %s  vlan %u  %s  %u",
+                      tm.tm_hour, tm.tm_min, tm.tm_sec,
+                      (unsigned long long)(slot->timestamp % 1000000000ULL) / 1000,
+                      name, slot->vlan_id, description, slot->len);
+    }
+    lv_label_set_text(capture_label, text);
+}
+
+void capture_cleanup() {
+    if (capture_rb)
+        ring_buffer__free(capture_rb);
+    capture_rb = NULL;
+    free(slots);
+    slots = NULL;
+    slot_count = slot_used = slot_head = 0;
+}
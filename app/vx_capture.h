@@ -0,0 +1,14 @@
+#ifndef VX_CAPTURE
+#define VX_CAPTURE
+
+#include <stdbool.h>
+#include <stddef.h>
+
+int  capture_init(int capture_map_fd, size_t ring_size);
+int  capture_poll();
+int  capture_dump(const char *path);
+void capture_view_toggle();
+void capture_view_update();
+void capture_cleanup();
+
+#endif
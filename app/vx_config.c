@@ -1,9 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cjson/cJSON.h>
 #include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
 
 #include <linux/types.h>
 #include <linux/if_link.h>
@@ -14,13 +20,51 @@
 #include "vx_config.h"
 #include "vx_models.h"
 #include "vx_network.h"
+#include "vx_stats.h"
+#include "vx_capture.h"
+#include "vx_sampler.h"
 
 static __u32 xdp_flags = VX_XDP_SKB;
+// XDP object loaded once and attached to every input
+static struct bpf_object *xdp_object = NULL;
+// Outputs referenced by the rules of every input, rule masks are bitmasks
+// over this table. Output sets, groups, filters and tunnels are shared maps,
+// their IDs are allocated across inputs and the maps hold the per-input
+// budget once for each input (map_inputs)
+static Interface* outputs[VX_MAX_OUTPUT_INTERFACES];
+static int   output_count = 0;
+static int   map_inputs = 1;
+static __u32 set_masks[VX_MAX_OUTPUT_SETS * VX_MAX_INPUT_INTERFACES];
+static __u32 set_count = 0;
+static __u32 group_masks[VX_MAX_OUTPUT_GROUPS * VX_MAX_INPUT_INTERFACES];
+static __u32 group_count = 0;
+static __u32 filter_count = 0;
+static __u32 tunnel_count = 0;
+
+// On-box capture of one VLAN (or pair, or "any") on every input
+static bool   capture_enabled = false;
+static __u32  capture_vlan_id;
+static int    capture_inner_vlan_id;
+static size_t capture_ring_size = VX_CAPTURE_RING_SIZE;
 extern InterfaceCollection* interface_collection;
 
 int load_configuration();
-struct bpf_object *load_bpf_object(Interface* interface);
-int setup_redirections(struct bpf_object *bpf_obj, cJSON *redirect_map, Interface* interface);
+struct bpf_object *load_bpf_object(int input_count);
+int attach_bpf_program(Interface* interface, __u32 flags);
+// Per-rule frame options, folded into vlan_action
+struct rule_options {
+	__u32 snaplen;     // 0 -> whole frame
+	__u32 sample_rate; // Mirror 1 frame out of sample_rate, 0 or 1 -> all
+	bool  sample_flow; // Keep or skip whole flows instead of random frames
+	__u32 filter;      // L3/L4 filter ID, 0 -> none
+	bool  group;       // Outputs are a load-balanced group
+	__u32 dedup_window; // Drop repeats seen within this many us, 0 -> off
+	__u32 tag;         // VX_VLAN_ACTION_TAG_* egress action, 0 -> none
+	__u32 tag_vid;
+	__u32 tunnel;      // Remote SPAN tunnel ID, 0 -> none
+};
+
+int setup_redirections(struct bpf_object *bpf_obj, cJSON *redirect_map, Interface* interface, const struct rule_options *defaults);
 
 /*
 {
@@ -33,23 +77,152 @@ int setup_redirections(struct bpf_object *bpf_obj, cJSON *redirect_map, Interfac
         "eth1": {
             "redirect_map": {
                 "10": "eth3",
-                "11": "eth3",
-                "12": "eth2"
-            }
+                "11": ["eth2", "eth3"],
+                "12": "eth2",
+                "13": { "outputs": "eth3", "snaplen": 128 },
+                "14": { "outputs": "eth3", "sample": 10, "sample_mode": "flow" },
+                "15": { "outputs": "eth2", "match": { "dst": "10.20.0.0/16", "proto": "tcp", "dport": 443 } },
+                "16": { "group": ["eth2", "eth3"] },
+                "17": { "outputs": "eth3", "dedup_us": 1000 },
+                "18": { "outputs": "eth3", "tag": { "push": 1001 } },
+                "19": { "encap": { "type": "erspan2", "device": "eth4", "dst": "192.0.2.10", "dst_mac": "02:00:00:00:00:01", "id": 19 } },
+                "100.20": "eth2"
+            },
+            "snaplen": 256
         }
     }
 }
 */
-int load_configuration() {
+// "xdp_mode": "HW" | "DRV" | "SKB" | "AUTO", leaves flags untouched if absent
+static int parse_xdp_mode(cJSON *xdp_mode, __u32 *flags) {
+	if (!xdp_mode)
+		return 0;
+	if (!cJSON_IsString(xdp_mode)) {
+		perror("Error: xdp_mode flag unsupported, expecting HW|DRV|SKB|AUTO");
+		return -1;
+	}
+	if (strcmp(xdp_mode->valuestring, "HW") == 0) {
+		*flags = VX_XDP_HW;
+	} else if (strcmp(xdp_mode->valuestring, "DRV") == 0) {
+		*flags = VX_XDP_DRV;
+	} else if (strcmp(xdp_mode->valuestring, "SKB") == 0) {
+		*flags = VX_XDP_SKB;
+	} else if (strcmp(xdp_mode->valuestring, "AUTO") == 0) {
+		*flags = VX_XDP_AUTO;
+	} else {
+		perror("Error: xdp_mode flag unsupported, expecting HW|DRV|SKB|AUTO");
+		return -1;
+	}
+	printf("XDP mode set to %s\n", xdp_mode->valuestring);
+	return 0;
+}
+
+// "snaplen": <bytes>, 0 mirrors whole frames
+// "sample": <N>, mirror 1 frame out of N, "sample_mode": "random" (default) | "flow"
+// "dedup_us": <us>, drop frames already mirrored within this window, 0 disables
+// "tag": "strip" | {"push": <vid>} | {"rewrite": <vid>}, egress tag action
+// Leaves options untouched when absent
+static int parse_rule_options(cJSON *json, struct rule_options *options) {
+	cJSON *snaplen = cJSON_GetObjectItem(json, "snaplen");
+	cJSON *sample = cJSON_GetObjectItem(json, "sample");
+	cJSON *sample_mode = cJSON_GetObjectItem(json, "sample_mode");
+	cJSON *dedup = cJSON_GetObjectItem(json, "dedup_us");
+	cJSON *tag = cJSON_GetObjectItem(json, "tag");
+
+	if (snaplen) {
+		if (!cJSON_IsNumber(snaplen) || (snaplen->valueint != 0 && snaplen->valueint < VX_MIN_SNAPLEN)) {
+			fprintf(stderr, "Error: snaplen must be 0 or at least %d bytes\n", VX_MIN_SNAPLEN);
+			return -1;
+		}
+		options->snaplen = snaplen->valueint;
+	}
+	if (sample) {
+		if (!cJSON_IsNumber(sample) || sample->valueint < 0) {
+			perror("Error: sample must be a positive ratio");
+			return -1;
+		}
+		options->sample_rate = sample->valueint;
+	}
+	if (sample_mode) {
+		if (cJSON_IsString(sample_mode) && strcmp(sample_mode->valuestring, "random") == 0) {
+			options->sample_flow = false;
+		} else if (cJSON_IsString(sample_mode) && strcmp(sample_mode->valuestring, "flow") == 0) {
+			options->sample_flow = true;
+		} else {
+			perror("Error: sample_mode unsupported, expecting random|flow");
+			return -1;
+		}
+	}
+	if (dedup) {
+		if (!cJSON_IsNumber(dedup) || dedup->valueint < 0) {
+			perror("Error: dedup_us must be a positive window");
+			return -1;
+		}
+		options->dedup_window = dedup->valueint;
+	}
+	if (tag) {
+		cJSON *push = cJSON_GetObjectItem(tag, "push");
+		cJSON *rewrite = cJSON_GetObjectItem(tag, "rewrite");
+		cJSON *vid = push ? push : rewrite;
+		if (cJSON_IsString(tag) && strcmp(tag->valuestring, "strip") == 0) {
+			options->tag = VX_VLAN_ACTION_TAG_STRIP;
+		} else if (cJSON_IsObject(tag) && cJSON_GetArraySize(tag) == 1 // push or rewrite, nothing else
+			&& cJSON_IsNumber(vid) && vid->valueint > 0 && vid->valueint < 4095) {
+			options->tag = push ? VX_VLAN_ACTION_TAG_PUSH : VX_VLAN_ACTION_TAG_REWRITE;
+			options->tag_vid = vid->valueint;
+		} else {
+			perror("Error: tag unsupported, expecting \"strip\" | {\"push\": <vid>} | {\"rewrite\": <vid>}");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int parse_vlan_id(const char *vlan_str, __u32 *vlan_id, int *inner_vlan_id);
+
+// "capture": {"vlan": "<vlan>", "ring_size": <bytes>}
+static int parse_capture(cJSON *capture) {
+	if (!capture)
+		return 0;
+	cJSON *vlan = cJSON_GetObjectItem(capture, "vlan");
+	cJSON *ring_size = cJSON_GetObjectItem(capture, "ring_size");
+	if (!cJSON_IsString(vlan) || parse_vlan_id(vlan->valuestring, &capture_vlan_id, &capture_inner_vlan_id) < 0) {
+		perror("Error: capture expects a \"vlan\" selector");
+		return -1;
+	}
+	if (ring_size) {
+		if (!cJSON_IsNumber(ring_size) || ring_size->valuedouble < VX_CAPTURE_SNAPLEN * 2
+			|| ring_size->valuedouble > VX_CAPTURE_RING_MAX) {
+			fprintf(stderr, "Error: capture ring_size must be between %d and %d bytes\n", VX_CAPTURE_SNAPLEN * 2, VX_CAPTURE_RING_MAX);
+			return -1;
+		}
+		capture_ring_size = ring_size->valueint;
+	}
+	capture_enabled = true;
+	printf("Capturing VLAN %s (%zu bytes ring)\n", vlan->valuestring, capture_ring_size);
+	return 0;
+}
+
+static bool capture_selected(__u32 vlan_id, int inner_vlan_id) {
+	if (!capture_enabled)
+		return false;
+	if (capture_vlan_id == 4095)
+		return true;
+	if (capture_vlan_id != vlan_id)
+		return false;
+	return capture_inner_vlan_id < 0 || capture_inner_vlan_id == inner_vlan_id;
+}
+
+// Contents of the JSON configuration file, to be freed
+static char *read_configuration() {
 	char *json_config = NULL;
 	FILE *file;
 	long length;
 
-	// Read JSON configuration file
 	file = fopen(VX_CONFIG_FILE, "r");
 	if (!file) {
 		perror("Error: opening config file failed");
-		return -1;
+		return NULL;
 	}
 
 	fseek(file, 0, SEEK_END);
@@ -62,10 +235,44 @@ int load_configuration() {
 	}
 	fclose(file);
 
-	if (!json_config) {
+	if (!json_config)
 		perror("Error: reading config file failed");
-		return -1;
+	return json_config;
+}
+
+// "vxspan.headless" on the kernel command line, or "headless": true in the
+// configuration: no display, rates are printed on the console instead
+bool config_headless() {
+	char cmdline[1024];
+	bool headless = false;
+
+	FILE *file = fopen("/proc/cmdline", "r");
+	if (file) {
+		if (fgets(cmdline, sizeof(cmdline), file)) {
+			for (char *token = strtok(cmdline, " \n"); token; token = strtok(NULL, " \n"))
+				if (strcmp(token, "vxspan.headless") == 0 || strcmp(token, "vxspan.headless=1") == 0)
+					headless = true;
+		}
+		fclose(file);
 	}
+	if (headless)
+		return true;
+
+	char *json_config = read_configuration();
+	if (!json_config)
+		return false;
+	cJSON *root = cJSON_Parse(json_config);
+	headless = root && cJSON_IsTrue(cJSON_GetObjectItem(root, "headless"));
+	cJSON_Delete(root);
+	free(json_config);
+	return headless;
+}
+
+int load_configuration() {
+	// Read JSON configuration file
+	char *json_config = read_configuration();
+	if (!json_config)
+		return -1;
 
 	cJSON *root = cJSON_Parse(json_config);
 	if (!root) {
@@ -74,19 +281,25 @@ int load_configuration() {
 		return -1;
 	}
 
-	cJSON *xdp_mode = cJSON_GetObjectItem(root, "xdp_mode");
-	if (cJSON_IsString(xdp_mode)) {
-		if (strcmp(xdp_mode->valuestring, "HW") == 0) {
-			xdp_flags = VX_XDP_HW;
-			puts("XDP mode set to HW");
-		} else if (strcmp(xdp_mode->valuestring, "DRV") == 0) {
-			xdp_flags = VX_XDP_DRV;
-			puts("XDP mode set to DrV");
-		} else if (strcmp(xdp_mode->valuestring, "SKB") == 0) {
-			xdp_flags = VX_XDP_SKB;
-			puts("XDP mode set to SKB");
-		} else
-			perror("Error: xdp_mode flag unsupported, expecting HW|DRV|SKB");
+	// Default XDP mode, can be overridden per input interface
+	if (parse_xdp_mode(cJSON_GetObjectItem(root, "xdp_mode"), &xdp_flags) < 0) {
+		cJSON_Delete(root);
+		free(json_config);
+		return -1;
+	}
+
+	if (parse_capture(cJSON_GetObjectItem(root, "capture")) < 0) {
+		cJSON_Delete(root);
+		free(json_config);
+		return -1;
+	}
+
+	// Period of the sampler thread, independent of the display refresh
+	cJSON *sample_period = cJSON_GetObjectItem(root, "sample_period_ms");
+	if (sample_period && (!cJSON_IsNumber(sample_period) || sampler_set_period(sample_period->valueint) < 0)) {
+		cJSON_Delete(root);
+		free(json_config);
+		return -1;
 	}
 
 	cJSON *interfaces = cJSON_GetObjectItem(root, "interfaces");
@@ -97,12 +310,27 @@ int load_configuration() {
 		return -1;
 	}
 
+	// One XDP object for every input, loaded and verified once
+	int input_count = cJSON_GetArraySize(interfaces);
+	if (input_count < 1 || input_count > VX_MAX_INPUT_INTERFACES) {
+		fprintf(stderr, "Error: 1 to %d input interfaces expected\n", VX_MAX_INPUT_INTERFACES);
+		cJSON_Delete(root);
+		free(json_config);
+		return -1;
+	}
+	xdp_object = load_bpf_object(input_count);
+	if (!xdp_object) {
+		cJSON_Delete(root);
+		free(json_config);
+		return -1;
+	}
+	map_inputs = input_count;
+
 	cJSON *json_interface;
 	cJSON_ArrayForEach(json_interface, interfaces) {
 		const char *interface_name = json_interface->string;
 		int if_index = if_nametoindex(interface_name);
 		Interface* interface = NULL;
-		struct bpf_object *bpf_obj;
 
 		if (interface_collection->input_count >= VX_MAX_INPUT_INTERFACES) {
 			perror("Too many output ports defined");
@@ -117,18 +345,20 @@ int load_configuration() {
 			return -1;
 		}
 
-		// Load and attach BPF object file
-		bpf_obj = load_bpf_object(interface);
-		if (!bpf_obj) {
+		// Attach the XDP program
+		__u32 interface_xdp_flags = xdp_flags;
+		if (parse_xdp_mode(cJSON_GetObjectItem(json_interface, "xdp_mode"), &interface_xdp_flags) < 0
+			|| attach_bpf_program(interface, interface_xdp_flags) < 0) {
 			cJSON_Delete(root);
 			free(json_config);
 			return -1;
 		}
 
 		// Configure the redirect map
+		struct rule_options defaults = {.snaplen = 0, .sample_rate = 0, .sample_flow = false, .filter = 0, .group = false, .dedup_window = 0, .tag = 0, .tag_vid = 0, .tunnel = 0};
 		cJSON *redirect_map = cJSON_GetObjectItem(json_interface, "redirect_map");
-		if (setup_redirections(bpf_obj, redirect_map, interface)) {
-			bpf_object__close(bpf_obj);
+		if (parse_rule_options(json_interface, &defaults) < 0
+			|| setup_redirections(xdp_object, redirect_map, interface, &defaults)) {
 			cJSON_Delete(root);
 			free(json_config);
 			return -1;
@@ -145,6 +375,12 @@ int load_configuration() {
 
 	printf("XDP programs successfully loaded and attached\n");
 
+	if (capture_enabled && capture_init(bpf_object__find_map_fd_by_name(xdp_object, VX_CAPTURE_MAP), capture_ring_size) < 0) {
+		cJSON_Delete(root);
+		free(json_config);
+		return -1;
+	}
+
 	Interface* input = interface_collection->input_head;
 	while (input) {
 		Vlan* vlan = input->vlan_stats;
@@ -160,41 +396,108 @@ int load_configuration() {
 	return 0;
 }
 
-struct bpf_object *load_bpf_object(Interface* interface) {
-	struct bpf_program *prog;
-	int prog_fd;
-
-	interface->bpf_prog = bpf_object__open_file(VX_XDP_FILE, NULL);
-	if (libbpf_get_error(interface->bpf_prog)) {
+// Per-input maps hold a block of entries for each input, shared maps
+// (output sets, groups, filters, tunnels) the per-input budget times inputs
+struct bpf_object *load_bpf_object(int input_count) {
+	static const struct {
+		const char *name;
+		__u32 entries;
+	} input_maps[] = {
+		{"vlan_redirect_map", VX_VLAN_COUNT},
+		{"qinq_redirect_map", VX_MAX_QINQ_RULES},
+		{"qinq_stats",        VX_MAX_QINQ_RULES},
+		{"tx_sets",           VX_MAX_OUTPUT_SETS},
+		{"tx_groups",         VX_MAX_OUTPUT_GROUPS},
+		{"filters",           VX_MAX_FILTERS},
+		{"filter_stats",      VX_MAX_FILTERS},
+		{"filter_src",        VX_MAX_FILTER_PREFIXES},
+		{"filter_dst",        VX_MAX_FILTER_PREFIXES},
+		{"tunnels",           VX_MAX_TUNNELS},
+	};
+	struct bpf_object *bpf_obj = bpf_object__open_file(VX_XDP_FILE, NULL);
+	if (libbpf_get_error(bpf_obj)) {
 		perror("Error: opening BPF object file failed");
 		return NULL;
 	}
 
-	if (bpf_object__load(interface->bpf_prog)) {
+	for (size_t i = 0; i < sizeof(input_maps) / sizeof(input_maps[0]); i++) {
+		struct bpf_map *map = bpf_object__find_map_by_name(bpf_obj, input_maps[i].name);
+		if (!map || bpf_map__set_max_entries(map, input_maps[i].entries * input_count)) {
+			perror("Error: sizing per-input BPF map failed");
+			bpf_object__close(bpf_obj);
+			return NULL;
+		}
+	}
+
+	// vlan_stats holds a slot per possible CPU for each input and VLAN,
+	// the datapath finds them with stats_cpus
+	__u32 stats_cpus = libbpf_num_possible_cpus();
+	struct bpf_map *stats_layout = bpf_object__find_map_by_name(bpf_obj, ".rodata.stats");
+	struct bpf_map *vlan_stats = bpf_object__find_map_by_name(bpf_obj, "vlan_stats");
+	if ((int)stats_cpus < 1 || !stats_layout || !vlan_stats
+		|| bpf_map__set_initial_value(stats_layout, &stats_cpus, sizeof(stats_cpus))
+		|| bpf_map__set_max_entries(vlan_stats, VX_VLAN_COUNT * input_count * stats_cpus)) {
+		perror("Error: sizing vlan_stats BPF map failed");
+		bpf_object__close(bpf_obj);
+		return NULL;
+	}
+
+	if (bpf_object__load(bpf_obj)) {
 		perror("Error: loading BPF object file failed");
-		bpf_object__close(interface->bpf_prog);
+		bpf_object__close(bpf_obj);
 		return NULL;
 	}
+	printf("XDP object loaded for %d input(s)\n", input_count);
+	return bpf_obj;
+}
+
+int attach_bpf_program(Interface* interface, __u32 flags) {
+	struct bpf_program *prog;
+	int prog_fd;
 
-	prog = bpf_object__find_program_by_name(interface->bpf_prog, VX_XDP_PROG_SECTION);
+	// Frames of interfaces without a slot are dropped by the datapath
+	__u32 if_index = interface->if_index;
+	__u32 slot = interface->input_slot;
+	int inputs_fd = bpf_object__find_map_fd_by_name(xdp_object, "inputs");
+	if (inputs_fd < 0 || bpf_map_update_elem(inputs_fd, &if_index, &slot, BPF_ANY)) {
+		perror("Error: registering input in BPF map failed");
+		return -1;
+	}
+
+	prog = bpf_object__find_program_by_name(xdp_object, VX_XDP_PROG_SECTION);
 	if (!prog) {
 		perror("Error: finding BPF program in object file failed");
-		return NULL;
+		return -1;
 	}
 
 	prog_fd = bpf_program__fd(prog);
 	if (prog_fd < 0) {
 		perror("Error: getting BPF program file descriptor failed");
-		bpf_object__close(interface->bpf_prog);
-		return NULL;
+		return -1;
 	}
+	interface->bpf_prog = xdp_object;
 
-	if (bpf_xdp_attach(interface->if_index, prog_fd, xdp_flags, NULL) < 0) {
+	// AUTO: native mode first, generic mode if the driver refuses it
+	if (flags == VX_XDP_AUTO) {
+		if (bpf_xdp_attach(interface->if_index, prog_fd, VX_XDP_DRV, NULL) == 0) {
+			flags = VX_XDP_DRV;
+		} else {
+			fprintf(stderr, "Warning: DRV attach failed on %s, falling back to SKB\n", interface->interface_name);
+			flags = VX_XDP_SKB;
+			if (bpf_xdp_attach(interface->if_index, prog_fd, flags, NULL) < 0) {
+				perror("Error: attaching BPF program to the interface failed");
+				return -1;
+			}
+		}
+	} else if (bpf_xdp_attach(interface->if_index, prog_fd, flags, NULL) < 0) {
 		perror("Error: attaching BPF program to the interface failed");
-		bpf_object__close(interface->bpf_prog);
-		return NULL;
+		return -1;
 	}
-	switch (xdp_flags) {
+	// Detach with the flags actually used
+	interface->xdp_flags = flags;
+	if (!interface->xdp_mode)
+		return 0;
+	switch (flags) {
 	case VX_XDP_HW:
 		lv_label_set_text(interface->xdp_mode, "HW");
 		break;
@@ -205,11 +508,575 @@ struct bpf_object *load_bpf_object(Interface* interface) {
 		lv_label_set_text(interface->xdp_mode, "SKB");
 		break;
 	}
-	return interface->bpf_prog;
+	return 0;
+}
+
+// "none" | "any" | "<vlan>" | "<outer>.<inner>", inner_vlan_id is -1 without inner tag
+static int parse_vlan_id(const char *vlan_str, __u32 *vlan_id, int *inner_vlan_id) {
+	const char *inner_str = strchr(vlan_str, '.');
+	*inner_vlan_id = -1;
+	if (strcmp(vlan_str, "none") == 0) {
+		*vlan_id = 0;
+	} else if (strcmp(vlan_str, "any") == 0) {
+		*vlan_id = 4095;
+	} else {
+		char *end;
+		long id = strtol(vlan_str, &end, 10);
+		if (end == vlan_str || end != (inner_str ? inner_str : vlan_str + strlen(vlan_str))
+			|| id < 1 || id >= VX_VLAN_COUNT) {
+			fprintf(stderr, "Error: Incorrect VLAN identifier %s\n", vlan_str);
+			return -1;
+		}
+		*vlan_id = (__u32)id;
+		if (inner_str) {
+			id = strtol(inner_str + 1, &end, 10);
+			if (*vlan_id == 4095 || end == inner_str + 1 || *end != '\0' || id < 0 || id >= 4095) {
+				fprintf(stderr, "Error: Incorrect inner VLAN identifier %s\n", vlan_str);
+				return -1;
+			}
+			*inner_vlan_id = (int)id;
+		}
+	}
+	return 0;
+}
+
+// Create (if needed) the output interface and add it to the rule output mask
+static int add_rule_output(Interface* interface, const char *interface_name, int tx_ports_fd,
+                           Interface** outputs, int *output_count, __u32 *mask) {
+	Interface* redirection = NULL;
+	__u32 if_index = if_nametoindex(interface_name);
+
+	if (if_index < 1) {
+		perror("Error: Input Interface not found");
+		return -1;
+	}
+
+	// Create output
+	bool exists = false;
+	redirection = interface->parent->output_head;
+	while (redirection) {
+		if (redirection->if_index == if_index) {
+			exists = true;
+			break;
+		}
+		redirection = redirection->next;
+	}
+	if (!exists) {
+		if (interface->parent->output_count >= VX_MAX_OUTPUT_INTERFACES) {
+			perror("Too many output ports defined");
+			return -1;
+		}
+		if (prepare_output_interface(interface_name) < 0)
+			return -1;
+		printf("add_output_interface(%u:%s))\n", if_index, interface_name);
+		redirection = add_output_interface(interface->parent, if_index, interface_name);
+		if (!redirection) {
+			return -1;
+		}
+	}
+
+	// Register output in the devmap used by bpf_redirect_map
+	if (bpf_map_update_elem(tx_ports_fd, &if_index, &if_index, BPF_ANY)) {
+		perror("Error: updating tx_ports BPF map element failed");
+		return -1;
+	}
+
+	// Local output index, used as the rule mask bit
+	int i;
+	for (i = 0; i < *output_count; i++)
+		if (outputs[i] == redirection)
+			break;
+	if (i == *output_count)
+		outputs[(*output_count)++] = redirection;
+	*mask |= 1U << i;
+	return 0;
 }
 
-int setup_redirections(struct bpf_object *bpf_obj, cJSON *redirect_map, Interface* interface) {
-	int vlan_redirect_map_fd, vlan_stats_fd;
+// Fill tx_sets[set_id] with a devmap holding every output of the mask
+static int create_output_set(int tx_sets_fd, __u32 set_id, Interface** outputs, __u32 mask) {
+	int set_fd = bpf_map_create(BPF_MAP_TYPE_DEVMAP_HASH, "tx_set", sizeof(__u32), sizeof(__u32), VX_TX_SET_SIZE, NULL);
+	if (set_fd < 0) {
+		perror("Error: creating tx_set BPF map failed");
+		return -1;
+	}
+	for (int i = 0; i < VX_MAX_OUTPUT_INTERFACES; i++) {
+		if (!(mask & (1U << i)))
+			continue;
+		__u32 if_index = outputs[i]->if_index;
+		if (bpf_map_update_elem(set_fd, &if_index, &if_index, BPF_ANY)) {
+			perror("Error: updating tx_set BPF map element failed");
+			close(set_fd);
+			return -1;
+		}
+	}
+	if (bpf_map_update_elem(tx_sets_fd, &set_id, &set_fd, BPF_ANY)) {
+		perror("Error: updating tx_sets BPF map element failed");
+		close(set_fd);
+		return -1;
+	}
+	// The outer map holds a reference on the set
+	close(set_fd);
+	return 0;
+}
+
+// "<output>" or ["<output>", ...]
+static int add_rule_outputs(Interface* interface, cJSON *item, const char *vlan_str, int tx_ports_fd,
+                            Interface** outputs, int *output_count, __u32 *mask) {
+	if (cJSON_IsString(item)) {
+		if (add_rule_output(interface, item->valuestring, tx_ports_fd, outputs, output_count, mask) < 0)
+			return -1;
+		printf("Adding VLAN XDP redirection: %s to interface %s\n", vlan_str, item->valuestring);
+	} else if (cJSON_IsArray(item)) {
+		cJSON *output;
+		cJSON_ArrayForEach(output, item) {
+			if (!cJSON_IsString(output)) {
+				perror("Error: redirect_map outputs must be interface names");
+				return -1;
+			}
+			if (add_rule_output(interface, output->valuestring, tx_ports_fd, outputs, output_count, mask) < 0)
+				return -1;
+			printf("Adding VLAN XDP redirection: %s to interface %s\n", vlan_str, output->valuestring);
+		}
+	} else {
+		perror("Error: redirect_map expects an output name or an array of output names");
+		return -1;
+	}
+	return 0;
+}
+
+// Options of a frame matching several rules: largest snaplen, highest
+// sampling ratio, shortest dedup window and no filter, 0 (whole frame /
+// every frame / no dedup / all) wins
+static int merge_options(struct rule_options *options, const struct rule_options *other) {
+	// A frame is redirected once: a group pick can't be combined with other outputs
+	if (options->group || other->group) {
+		perror("Error: output group rules can't overlap other rules");
+		return -1;
+	}
+	// Encapsulation applies to every copy of the frame
+	if (options->tunnel || other->tunnel) {
+		perror("Error: encap rules can't overlap other rules");
+		return -1;
+	}
+	// A filter selects the frames of its outputs, widening it to the whole
+	// VLAN for the other rule would mirror traffic the user excluded
+	if (options->filter != other->filter) {
+		perror("Error: overlapping rules with different L3/L4 filters");
+		return -1;
+	}
+	// Clones share the frame, they can't be tagged differently
+	if (options->tag != other->tag || options->tag_vid != other->tag_vid) {
+		perror("Error: overlapping rules with different tag actions");
+		return -1;
+	}
+
+	if (!options->snaplen || !other->snaplen)
+		options->snaplen = 0;
+	else if (options->snaplen < other->snaplen)
+		options->snaplen = other->snaplen;
+
+	if (options->sample_rate <= 1 || other->sample_rate <= 1) {
+		options->sample_rate = 0;
+		options->sample_flow = false;
+	} else if (options->sample_rate > other->sample_rate) {
+		options->sample_rate = other->sample_rate;
+		options->sample_flow = other->sample_flow;
+	} else if (options->sample_rate == other->sample_rate) {
+		options->sample_flow = options->sample_flow && other->sample_flow;
+	}
+
+	if (!options->dedup_window || !other->dedup_window)
+		options->dedup_window = 0;
+	else if (options->dedup_window > other->dedup_window)
+		options->dedup_window = other->dedup_window;
+	return 0;
+}
+
+static void apply_options(struct vlan_action *action, const struct rule_options *options) {
+	action->snaplen = options->snaplen;
+	action->sample_rate = options->sample_rate;
+	action->filter = options->filter;
+	action->dedup_window = options->dedup_window;
+	action->flags |= options->tag;
+	action->tag_vid = options->tag_vid;
+	action->tunnel = options->tunnel;
+	if (options->sample_rate > 1 && options->sample_flow)
+		action->flags |= VX_VLAN_ACTION_SAMPLE_FLOW;
+}
+
+// "<address>[/<length>]", IPv4 is stored as IPv4-mapped IPv6
+static int parse_prefix(const char *prefix_str, __u32 filter_id, struct filter_key *key) {
+	char address[INET6_ADDRSTRLEN];
+	const char *length_str = strchr(prefix_str, '/');
+	size_t address_length = length_str ? (size_t)(length_str - prefix_str) : strlen(prefix_str);
+	int length;
+
+	if (address_length >= sizeof(address)) {
+		fprintf(stderr, "Error: invalid prefix %s\n", prefix_str);
+		return -1;
+	}
+	memcpy(address, prefix_str, address_length);
+	address[address_length] = '\0';
+
+	memset(key, 0, sizeof(*key));
+	key->filter = filter_id;
+	if (inet_pton(AF_INET, address, &key->addr[3]) == 1) {
+		key->addr[2] = htonl(0xffff);
+		length = length_str ? atoi(length_str + 1) : 32;
+		if (length < 0 || length > 32) {
+			fprintf(stderr, "Error: invalid prefix %s\n", prefix_str);
+			return -1;
+		}
+		length += 96;
+	} else if (inet_pton(AF_INET6, address, key->addr) == 1) {
+		length = length_str ? atoi(length_str + 1) : 128;
+		if (length < 0 || length > 128) {
+			fprintf(stderr, "Error: invalid prefix %s\n", prefix_str);
+			return -1;
+		}
+	} else {
+		fprintf(stderr, "Error: invalid prefix %s\n", prefix_str);
+		return -1;
+	}
+	key->prefixlen = 32 + length;
+	return 0;
+}
+
+static int add_filter_prefix(int trie_fd, cJSON *prefix, __u32 filter_id) {
+	struct filter_key key;
+	__u32 value = 1;
+	if (!cJSON_IsString(prefix) || parse_prefix(prefix->valuestring, filter_id, &key) < 0
+		|| bpf_map_update_elem(trie_fd, &key, &value, BPF_ANY)) {
+		perror("Error: adding filter prefix failed");
+		return -1;
+	}
+	return 0;
+}
+
+// "<prefix>" or ["<prefix>", ...]
+static int add_filter_prefixes(int trie_fd, cJSON *json, __u32 filter_id) {
+	cJSON *prefix;
+	if (!cJSON_IsArray(json))
+		return add_filter_prefix(trie_fd, json, filter_id);
+	cJSON_ArrayForEach(prefix, json) {
+		if (add_filter_prefix(trie_fd, prefix, filter_id) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+// <port> or "<min>-<max>", leaves the range untouched if absent
+static int parse_port_range(cJSON *json, __u16 *min, __u16 *max) {
+	int low, high;
+	if (!json)
+		return 0;
+	if (cJSON_IsNumber(json)) {
+		low = high = json->valueint;
+	} else if (!cJSON_IsString(json) || sscanf(json->valuestring, "%d-%d", &low, &high) != 2) {
+		perror("Error: port expects <port> or \"<min>-<max>\"");
+		return -1;
+	}
+	if (low < 0 || high > 65535 || low > high) {
+		perror("Error: invalid port range");
+		return -1;
+	}
+	*min = low;
+	*max = high;
+	return 0;
+}
+
+// "match": {"src": <prefixes>, "dst": <prefixes>, "proto": "tcp" | "udp" | "icmp" | "icmpv6" | <number>,
+//           "sport": <ports>, "dport": <ports>}
+static int setup_filter(struct bpf_object *bpf_obj, cJSON *match, __u32 filter_id) {
+	int filters_fd = bpf_object__find_map_fd_by_name(bpf_obj, "filters");
+	int filter_src_fd = bpf_object__find_map_fd_by_name(bpf_obj, "filter_src");
+	int filter_dst_fd = bpf_object__find_map_fd_by_name(bpf_obj, "filter_dst");
+	if (filters_fd < 0 || filter_src_fd < 0 || filter_dst_fd < 0) {
+		perror("Error: getting filter BPF maps file descriptors failed");
+		return -1;
+	}
+
+	struct vx_filter filter = {.sport_min = 0, .sport_max = 65535, .dport_min = 0, .dport_max = 65535};
+	cJSON *src = cJSON_GetObjectItem(match, "src");
+	cJSON *dst = cJSON_GetObjectItem(match, "dst");
+	cJSON *proto = cJSON_GetObjectItem(match, "proto");
+
+	if (!cJSON_IsObject(match)) {
+		perror("Error: match expects an object");
+		return -1;
+	}
+	if (src) {
+		if (add_filter_prefixes(filter_src_fd, src, filter_id) < 0)
+			return -1;
+		filter.flags |= VX_FILTER_SRC;
+	}
+	if (dst) {
+		if (add_filter_prefixes(filter_dst_fd, dst, filter_id) < 0)
+			return -1;
+		filter.flags |= VX_FILTER_DST;
+	}
+	if (proto) {
+		if (cJSON_IsNumber(proto) && proto->valueint >= 0 && proto->valueint < 256) {
+			filter.proto = proto->valueint;
+		} else if (cJSON_IsString(proto) && strcmp(proto->valuestring, "tcp") == 0) {
+			filter.proto = IPPROTO_TCP;
+		} else if (cJSON_IsString(proto) && strcmp(proto->valuestring, "udp") == 0) {
+			filter.proto = IPPROTO_UDP;
+		} else if (cJSON_IsString(proto) && strcmp(proto->valuestring, "icmp") == 0) {
+			filter.proto = IPPROTO_ICMP;
+		} else if (cJSON_IsString(proto) && strcmp(proto->valuestring, "icmpv6") == 0) {
+			filter.proto = IPPROTO_ICMPV6;
+		} else {
+			perror("Error: proto unsupported, expecting tcp|udp|icmp|icmpv6|<number>");
+			return -1;
+		}
+		filter.flags |= VX_FILTER_PROTO;
+	}
+	if (parse_port_range(cJSON_GetObjectItem(match, "sport"), &filter.sport_min, &filter.sport_max) < 0
+		|| parse_port_range(cJSON_GetObjectItem(match, "dport"), &filter.dport_min, &filter.dport_max) < 0)
+		return -1;
+
+	if (bpf_map_update_elem(filters_fd, &filter_id, &filter, BPF_ANY)) {
+		perror("Error: updating filters BPF map element failed");
+		return -1;
+	}
+	return 0;
+}
+
+static __u16 ipv4_checksum(const struct iphdr *ip) {
+	const __u16 *words = (const __u16 *)ip;
+	__u32 sum = 0;
+	for (int i = 0; i < ip->ihl * 2; i++)
+		sum += ntohs(words[i]);
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+// "encap": {"type": "gre" | "erspan2" | "erspan3" | "vxlan", "device": <output>, "dst": <IPv4>,
+//           "dst_mac": <next hop MAC>, "src": <IPv4>, "id": <ERSPAN session | VNI>, "port": <VXLAN port>}
+// The source MAC, and the source address if absent, are the ones of the transport device
+static int setup_tunnel(struct bpf_object *bpf_obj, cJSON *encap, __u32 tunnel_id) {
+	int tunnels_fd = bpf_object__find_map_fd_by_name(bpf_obj, "tunnels");
+	if (tunnels_fd < 0) {
+		perror("Error: getting tunnels BPF map file descriptor failed");
+		return -1;
+	}
+
+	cJSON *type = cJSON_GetObjectItem(encap, "type");
+	cJSON *device = cJSON_GetObjectItem(encap, "device");
+	cJSON *dst = cJSON_GetObjectItem(encap, "dst");
+	cJSON *dst_mac = cJSON_GetObjectItem(encap, "dst_mac");
+	cJSON *src = cJSON_GetObjectItem(encap, "src");
+	cJSON *id = cJSON_GetObjectItem(encap, "id");
+	cJSON *port = cJSON_GetObjectItem(encap, "port");
+	__u32 id_value = cJSON_IsNumber(id) ? (__u32)id->valueint : 0;
+	struct tunnel tunnel;
+	int header_len;
+
+	memset(&tunnel, 0, sizeof(tunnel));
+	if (!cJSON_IsString(type)) {
+		perror("Error: encap type unsupported, expecting gre|erspan2|erspan3|vxlan");
+		return -1;
+	} else if (strcmp(type->valuestring, "gre") == 0) {
+		tunnel.type = VX_TUNNEL_GRE;
+		header_len = 38;
+	} else if (strcmp(type->valuestring, "erspan2") == 0) {
+		tunnel.type = VX_TUNNEL_ERSPAN2;
+		header_len = 50;
+	} else if (strcmp(type->valuestring, "erspan3") == 0) {
+		tunnel.type = VX_TUNNEL_ERSPAN3;
+		header_len = 54;
+	} else if (strcmp(type->valuestring, "vxlan") == 0) {
+		tunnel.type = VX_TUNNEL_VXLAN;
+		header_len = 50;
+	} else {
+		perror("Error: encap type unsupported, expecting gre|erspan2|erspan3|vxlan");
+		return -1;
+	}
+	if (!cJSON_IsString(device) || !cJSON_IsString(dst) || !cJSON_IsString(dst_mac)) {
+		perror("Error: encap expects device, dst and dst_mac");
+		return -1;
+	}
+
+	// Ethernet
+	struct ethhdr *eth = (struct ethhdr *)tunnel.header;
+	unsigned char *mac = eth->h_dest;
+	if (sscanf(dst_mac->valuestring, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+	           &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 6) {
+		perror("Error: invalid encap dst_mac");
+		return -1;
+	}
+	if (interface_get_mac(device->valuestring, eth->h_source) < 0)
+		return -1;
+	eth->h_proto = htons(ETH_P_IP);
+
+	// IPv4, total length of an empty payload
+	struct iphdr *ip = (struct iphdr *)(eth + 1);
+	ip->version = 4;
+	ip->ihl = 5;
+	ip->ttl = 64;
+	ip->protocol = tunnel.type == VX_TUNNEL_VXLAN ? IPPROTO_UDP : IPPROTO_GRE;
+	ip->tot_len = htons(header_len - sizeof(*eth));
+	if (inet_pton(AF_INET, dst->valuestring, &ip->daddr) != 1) {
+		perror("Error: invalid encap dst");
+		return -1;
+	}
+	if (cJSON_IsString(src)) {
+		if (inet_pton(AF_INET, src->valuestring, &ip->saddr) != 1) {
+			perror("Error: invalid encap src");
+			return -1;
+		}
+	} else if (interface_get_ipv4(device->valuestring, &ip->saddr) < 0) {
+		return -1;
+	}
+	ip->check = htons(ipv4_checksum(ip));
+
+	// GRE (+ ERSPAN) or UDP + VXLAN
+	__u8 *l4 = (__u8 *)(ip + 1);
+	switch (tunnel.type) {
+	case VX_TUNNEL_GRE:
+		*(__be16 *)(l4 + 2) = htons(ETH_P_TEB);
+		break;
+	case VX_TUNNEL_ERSPAN2:
+	case VX_TUNNEL_ERSPAN3:
+		*(__be16 *)l4 = htons(0x1000); // Sequence number present
+		*(__be16 *)(l4 + 2) = htons(tunnel.type == VX_TUNNEL_ERSPAN2 ? ETH_P_ERSPAN : ETH_P_ERSPAN2);
+		*(__be16 *)(l4 + 10) = htons(id_value & 0x3ff); // Session ID
+		break;
+	case VX_TUNNEL_VXLAN: {
+		struct udphdr *udp = (struct udphdr *)l4;
+		udp->source = htons(4789); // Replaced per frame by a flow hash
+		udp->dest = htons(cJSON_IsNumber(port) ? port->valueint : 4789);
+		udp->len = htons(sizeof(*udp) + 8);
+		l4[sizeof(*udp)] = 0x08; // VNI present
+		*(__be32 *)(l4 + sizeof(*udp) + 4) = htonl((id_value & 0xffffff) << 8);
+		break;
+	}
+	}
+
+	if (bpf_map_update_elem(tunnels_fd, &tunnel_id, &tunnel, BPF_ANY)) {
+		perror("Error: updating tunnels BPF map element failed");
+		return -1;
+	}
+	printf("Adding %s tunnel %u to %s through %s\n", type->valuestring, tunnel_id, dst->valuestring, device->valuestring);
+	return 0;
+}
+
+static int add_configured_vlan(Interface* interface, __u32 vlan_id, int inner_vlan_id, __u32 mask,
+                               Interface** outputs, int output_count) {
+	if (inner_vlan_id < 0)
+		printf("Adding VLAN %u to interface %s (%d)\n", vlan_id, interface->interface_name, interface->if_index);
+	else
+		printf("Adding VLAN %u.%d to interface %s (%d)\n", vlan_id, inner_vlan_id, interface->interface_name, interface->if_index);
+	Vlan* vlan = add_or_update_vlan(interface, vlan_id, inner_vlan_id);
+	if (!vlan) {
+		return -1;
+	}
+	for (int i = 0; i < output_count; i++) {
+		if ((mask & (1U << i)) && Vlan_add_redirection(vlan, outputs[i]) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+// Fill an action record for the output mask, sharing one output set per distinct mask
+static int build_action(struct vlan_action *action, __u32 mask, Interface** outputs, int tx_sets_fd,
+                        __u32 *set_masks, __u32 *set_count) {
+	action->ifindex = outputs[__builtin_ctz(mask)]->if_index;
+	if (!(mask & (mask - 1)))
+		return 0;
+
+	// Several outputs
+	__u32 set_id;
+	for (set_id = 0; set_id < *set_count; set_id++)
+		if (set_masks[set_id] == mask)
+			break;
+	if (set_id == *set_count) {
+		if (*set_count >= (__u32)(VX_MAX_OUTPUT_SETS * map_inputs)) {
+			perror("Too many distinct output sets defined");
+			return -1;
+		}
+		if (create_output_set(tx_sets_fd, set_id, outputs, mask) < 0)
+			return -1;
+		set_masks[(*set_count)++] = mask;
+	}
+	action->flags |= VX_VLAN_ACTION_BROADCAST;
+	action->output_set = set_id;
+	return 0;
+}
+
+// Fill an action record balancing the output mask, one group per distinct mask
+static int build_group_action(struct vlan_action *action, __u32 mask, Interface** outputs, int tx_groups_fd,
+                              __u32 *group_masks, __u32 *group_count) {
+	__u32 group_id;
+	for (group_id = 0; group_id < *group_count; group_id++)
+		if (group_masks[group_id] == mask)
+			break;
+	if (group_id == *group_count) {
+		if (*group_count >= (__u32)(VX_MAX_OUTPUT_GROUPS * map_inputs)) {
+			perror("Too many distinct output groups defined");
+			return -1;
+		}
+		struct tx_group group;
+		memset(&group, 0, sizeof(group));
+		for (int i = 0; i < VX_MAX_OUTPUT_INTERFACES; i++)
+			if (mask & (1U << i))
+				group.ifindex[group.count++] = outputs[i]->if_index;
+		if (bpf_map_update_elem(tx_groups_fd, &group_id, &group, BPF_ANY)) {
+			perror("Error: updating tx_groups BPF map element failed");
+			return -1;
+		}
+		group_masks[(*group_count)++] = mask;
+	}
+	action->ifindex = outputs[__builtin_ctz(mask)]->if_index;
+	action->flags |= VX_VLAN_ACTION_GROUP;
+	action->output_set = group_id;
+	return 0;
+}
+
+// Pipeline stages an action goes through, same tests as the datapath
+static __u32 action_stages(const struct vlan_action *action) {
+	__u32 stages = 0;
+	if (action->filter || action->dedup_window || action->sample_rate > 1
+		|| (action->flags & (VX_VLAN_ACTION_GROUP | VX_VLAN_ACTION_CAPTURE)))
+		stages |= 1 << VX_STAGE_CLASSIFY;
+	if (action->snaplen || action->tunnel
+		|| (action->flags & (VX_VLAN_ACTION_TAG_PUSH | VX_VLAN_ACTION_TAG_REWRITE | VX_VLAN_ACTION_TAG_STRIP)))
+		stages |= 1 << VX_STAGE_ACTION;
+	return stages;
+}
+
+// Add the stages used by the rules of this input to the pipeline map. The map
+// is shared, it ends up with the stages any input needs; a frame only reaches
+// them when its own rule needs them, plain VLAN rules never leave
+// xdp_vlan_filter
+static int setup_pipeline(struct bpf_object *bpf_obj, const char *interface_name, __u32 stages) {
+	static const char *stage_programs[VX_PIPELINE_STAGES] = {
+		[VX_STAGE_CLASSIFY] = "xdp_stage_classify",
+		[VX_STAGE_ACTION]   = "xdp_stage_action",
+	};
+	int pipeline_fd = bpf_object__find_map_fd_by_name(bpf_obj, VX_PIPELINE_MAP);
+	if (pipeline_fd < 0) {
+		perror("Error: getting pipeline BPF map file descriptor failed");
+		return -1;
+	}
+	for (__u32 stage = 0; stage < VX_PIPELINE_STAGES; stage++) {
+		if (!(stages & (1 << stage)))
+			continue;
+		struct bpf_program *prog = bpf_object__find_program_by_name(bpf_obj, stage_programs[stage]);
+		int prog_fd = prog ? bpf_program__fd(prog) : -1;
+		if (prog_fd < 0 || bpf_map_update_elem(pipeline_fd, &stage, &prog_fd, BPF_ANY)) {
+			perror("Error: installing XDP pipeline stage failed");
+			return -1;
+		}
+		printf("Pipeline stage %s installed for %s\n", stage_programs[stage], interface_name);
+	}
+	return 0;
+}
+
+int setup_redirections(struct bpf_object *bpf_obj, cJSON *redirect_map, Interface* interface, const struct rule_options *defaults) {
+	int vlan_redirect_map_fd, vlan_stats_fd, tx_ports_fd, tx_sets_fd, tx_groups_fd, qinq_redirect_map_fd, qinq_stats_fd;
 
 	vlan_redirect_map_fd = bpf_object__find_map_fd_by_name(bpf_obj, "vlan_redirect_map");
 	if(vlan_redirect_map_fd < 0) {
@@ -223,80 +1090,186 @@ int setup_redirections(struct bpf_object *bpf_obj, cJSON *redirect_map, Interfac
 		return -1;
 	}
 	interface->vlan_stats_fd = vlan_stats_fd;
+	if (vlan_stats_mmap(vlan_stats_fd) < 0)
+		return -1;
+	tx_ports_fd = bpf_object__find_map_fd_by_name(bpf_obj, "tx_ports");
+	if(tx_ports_fd < 0) {
+		perror("Error: getting tx_ports BPF map file descriptor failed");
+		return -1;
+	}
+	tx_sets_fd = bpf_object__find_map_fd_by_name(bpf_obj, "tx_sets");
+	if(tx_sets_fd < 0) {
+		perror("Error: getting tx_sets BPF map file descriptor failed");
+		return -1;
+	}
+	tx_groups_fd = bpf_object__find_map_fd_by_name(bpf_obj, "tx_groups");
+	if(tx_groups_fd < 0) {
+		perror("Error: getting tx_groups BPF map file descriptor failed");
+		return -1;
+	}
+	qinq_redirect_map_fd = bpf_object__find_map_fd_by_name(bpf_obj, "qinq_redirect_map");
+	if(qinq_redirect_map_fd < 0) {
+		perror("Error: getting qinq_redirect_map BPF map file descriptor failed");
+		return -1;
+	}
+	qinq_stats_fd = bpf_object__find_map_fd_by_name(bpf_obj, "qinq_stats");
+	if(qinq_stats_fd < 0) {
+		perror("Error: getting qinq_stats BPF map file descriptor failed");
+		return -1;
+	}
+	interface->qinq_stats_fd = qinq_stats_fd;
+
+	__u32 masks[VX_VLAN_COUNT];
+	struct rule_options options[VX_VLAN_COUNT];
+	memset(masks, 0, sizeof(masks));
+	// (outer, inner) rules
+	struct { __u32 vlan_id; int inner_vlan_id; __u32 mask; struct rule_options options; } pairs[VX_MAX_QINQ_RULES];
+	int pair_count = 0;
 
 	cJSON *item;
 	cJSON_ArrayForEach(item, redirect_map) {
-		Interface* redirection = NULL;
 		const char *vlan_str = item->string;
-		const char *interface_name = cJSON_GetStringValue(item);
-
 		__u32 vlan_id;
-		__u32 if_index = if_nametoindex(interface_name);
+		int inner_vlan_id;
+		__u32 *mask;
+		struct rule_options *rule_options;
 
-		if (if_index < 1) {
-			perror("Error: Input Interface not found");
+		if (parse_vlan_id(vlan_str, &vlan_id, &inner_vlan_id) < 0)
 			return -1;
-		}
-
-		// Create output
-		bool exists = false;
-		redirection = interface->parent->output_head;
-		while (redirection) {
-			if (redirection->if_index == if_index) {
-				exists = true;
-				break;
+		if (inner_vlan_id < 0) {
+			mask = &masks[vlan_id];
+			rule_options = &options[vlan_id];
+		} else {
+			if (pair_count >= VX_MAX_QINQ_RULES) {
+				perror("Too many (outer, inner) VLAN rules defined");
+				return -1;
 			}
-			redirection = redirection->next;
+			pairs[pair_count].vlan_id = vlan_id;
+			pairs[pair_count].inner_vlan_id = inner_vlan_id;
+			pairs[pair_count].mask = 0;
+			rule_options = &pairs[pair_count].options;
+			mask = &pairs[pair_count++].mask;
 		}
-		if (!exists) {
-			if (interface->parent->output_count >= VX_MAX_OUTPUT_INTERFACES) {
-				perror("Too many output ports defined");
+		*rule_options = *defaults;
+
+		// "<vlan>": <outputs> or "<vlan>": {"outputs": <outputs>, <rule options>}
+		// item keeps walking redirect_map, the outputs get their own pointer
+		cJSON *rule_outputs = item;
+		if (cJSON_IsObject(item)) {
+			if (parse_rule_options(item, rule_options) < 0)
 				return -1;
+			cJSON *match = cJSON_GetObjectItem(item, "match");
+			if (match) {
+				if (filter_count >= (__u32)(VX_MAX_FILTERS * map_inputs - 1)) {
+					perror("Too many L3/L4 filters defined");
+					return -1;
+				}
+				rule_options->filter = ++filter_count;
+				if (setup_filter(bpf_obj, match, rule_options->filter) < 0)
+					return -1;
 			}
-			if (prepare_output_interface(interface_name) < 0)
-				return -1;
-			printf("add_output_interface(%u:%s))\n", if_index, interface_name);
-			redirection = add_output_interface(interface->parent, if_index, interface_name);
-			if (!redirection) {
-				return -1;
+			// "encap": frames are tunneled to a remote collector through "device"
+			// "group": members share the traffic instead of each getting a copy
+			cJSON *encap = cJSON_GetObjectItem(item, "encap");
+			cJSON *group = cJSON_GetObjectItem(item, "group");
+			if (encap) {
+				if (tunnel_count >= (__u32)(VX_MAX_TUNNELS * map_inputs - 1)) {
+					perror("Too many encap rules defined");
+					return -1;
+				}
+				rule_options->tunnel = ++tunnel_count;
+				if (setup_tunnel(bpf_obj, encap, rule_options->tunnel) < 0)
+					return -1;
+				rule_outputs = cJSON_GetObjectItem(encap, "device");
+			} else if (group) {
+				rule_options->group = true;
+				rule_outputs = group;
+			} else {
+				rule_outputs = cJSON_GetObjectItem(item, "outputs");
 			}
 		}
+		if (add_rule_outputs(interface, rule_outputs, vlan_str, tx_ports_fd, outputs, &output_count, mask) < 0)
+			return -1;
+	}
 
-		// Parse and update vlan config for input
-		if (strcmp(vlan_str, "none") == 0) {
-			vlan_id = 0;
-		} else if (strcmp(vlan_str, "any") == 0) {
-			vlan_id = 4095;
-		} else {
-			vlan_id = (__u32)atoi(vlan_str);
-			if (vlan_id == 0) {
-				perror("Error: Incorrect VLAN identifier");
+	// Fold the "any" rule into every slot so the datapath needs a single lookup,
+	// VLANs with both a specific and an "any" rule are sent to both output sets
+	struct vlan_action actions[VX_VLAN_COUNT];
+	__u32 keys[VX_VLAN_COUNT];
+	__u32 stages = 0;
+	memset(actions, 0, sizeof(actions));
+	for (__u32 vlan_id = 0; vlan_id < VX_VLAN_COUNT; vlan_id++) {
+		__u32 mask = masks[vlan_id] | masks[4095];
+		keys[vlan_id] = interface->input_slot * VX_VLAN_COUNT + vlan_id;
+		if (!mask)
+			continue;
+		if (masks[vlan_id])
+			actions[vlan_id].flags = VX_VLAN_ACTION_RULE;
+		struct rule_options slot_options = masks[vlan_id] ? options[vlan_id] : options[4095];
+		if (masks[vlan_id] && masks[4095] && merge_options(&slot_options, &options[4095]) < 0)
+			return -1;
+		apply_options(&actions[vlan_id], &slot_options);
+		if (capture_selected(vlan_id, -1))
+			actions[vlan_id].flags |= VX_VLAN_ACTION_CAPTURE;
+		if (slot_options.group) {
+			if (build_group_action(&actions[vlan_id], mask, outputs, tx_groups_fd, group_masks, &group_count) < 0)
 				return -1;
-			}
-		}
-		printf("Adding VLAN XDP redirection:%d %s (%u) to interface %s (%d)\n", vlan_redirect_map_fd, vlan_str, vlan_id, interface_name, if_index);
-		if (bpf_map_update_elem(vlan_redirect_map_fd, &vlan_id, &if_index, BPF_ANY)) {
-			perror("Error: updating BPF map element failed");
+		} else if (build_action(&actions[vlan_id], mask, outputs, tx_sets_fd, set_masks, &set_count) < 0) {
 			return -1;
 		}
+		stages |= action_stages(&actions[vlan_id]);
+	}
+	__u32 count = VX_VLAN_COUNT;
+	if (bpf_map_update_batch(vlan_redirect_map_fd, keys, actions, &count, NULL)) {
+		perror("Error: updating BPF map elements failed");
+		return -1;
+	}
 
-		// Create VLAN
-		exists = false;
-		Vlan* vlan = interface->vlan_stats;
-		while (vlan) {
-			if (vlan->vlan_id == vlan_id) {
-				exists = true;
-				break;
-			}
-			vlan = vlan->next;
+	// (outer, inner) rules also get the outer VLAN and "any" outputs,
+	// their statistics entries are created here so the datapath never inserts
+	struct vlan_stats* zeros = calloc(libbpf_num_possible_cpus(), sizeof(struct vlan_stats));
+	if (!zeros) {
+		perror("calloc failed");
+		return -1;
+	}
+	for (int i = 0; i < pair_count; i++) {
+		struct vlan_action action = {.flags = VX_VLAN_ACTION_RULE};
+		__u32 key = VX_QINQ_KEY(interface->input_slot, pairs[i].vlan_id, pairs[i].inner_vlan_id);
+		__u32 mask = pairs[i].mask | masks[pairs[i].vlan_id] | masks[4095];
+		if ((masks[pairs[i].vlan_id] && merge_options(&pairs[i].options, &options[pairs[i].vlan_id]) < 0)
+			|| (masks[4095] && merge_options(&pairs[i].options, &options[4095]) < 0)) {
+			free(zeros);
+			return -1;
 		}
-		if (!exists) {
-			printf("Adding VLAN %s (%u) to interface %s (%d)\n", vlan_str, vlan_id, interface_name, if_index);
-			vlan = add_or_update_vlan(interface, vlan_id);
-			if (!vlan) {
-				return -1;
-			}
+		apply_options(&action, &pairs[i].options);
+		if (capture_selected(pairs[i].vlan_id, pairs[i].inner_vlan_id))
+			action.flags |= VX_VLAN_ACTION_CAPTURE;
+		if ((pairs[i].options.group
+				? build_group_action(&action, mask, outputs, tx_groups_fd, group_masks, &group_count)
+				: build_action(&action, mask, outputs, tx_sets_fd, set_masks, &set_count)) < 0
+			|| bpf_map_update_elem(qinq_redirect_map_fd, &key, &action, BPF_ANY)
+			|| bpf_map_update_elem(qinq_stats_fd, &key, zeros, BPF_ANY)) {
+			perror("Error: updating (outer, inner) BPF map elements failed");
+			free(zeros);
+			return -1;
 		}
+		stages |= action_stages(&action);
+	}
+	free(zeros);
+
+	if (setup_pipeline(bpf_obj, interface->interface_name, stages) < 0)
+		return -1;
+
+	// Create VLANs with their configured redirections
+	for (__u32 vlan_id = 0; vlan_id < VX_VLAN_COUNT; vlan_id++) {
+		if (!masks[vlan_id])
+			continue;
+		if (add_configured_vlan(interface, vlan_id, -1, masks[vlan_id], outputs, output_count) < 0)
+			return -1;
+	}
+	for (int i = 0; i < pair_count; i++) {
+		if (add_configured_vlan(interface, pairs[i].vlan_id, pairs[i].inner_vlan_id, pairs[i].mask, outputs, output_count) < 0)
+			return -1;
 	}
 
 	return 0;
@@ -307,10 +1280,11 @@ void xdp_cleanup() {
 		return;
 	Interface* interface = interface_collection->input_head;
 	while (interface) {
-		if (bpf_xdp_detach(interface->if_index, xdp_flags, NULL) < 0) {
+		if (bpf_xdp_detach(interface->if_index, interface->xdp_flags, NULL) < 0) {
 			perror("xdp_program__detach");
 		}
-		bpf_object__close(interface->bpf_prog);
 		interface = interface->next;
 	}
+	bpf_object__close(xdp_object);
+	xdp_object = NULL;
 }
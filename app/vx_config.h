@@ -2,6 +2,7 @@
 #define VX_CONFIG
 
 #include "lvgl/lvgl.h"
+#include <linux/types.h>
 #include <linux/if_link.h>
 #include <stdbool.h>
 
@@ -13,7 +14,30 @@
 #define VX_MAX_INPUT_INTERFACES 10
 #define VX_MAX_OUTPUT_INTERFACES 10
 
+#define VX_MAX_OUTPUT_SETS 64 // tx_sets entries per input (distinct multi-output rules, shared IDs)
+#define VX_TX_SET_SIZE     16 // tx_set devmap size, >= VX_MAX_OUTPUT_INTERFACES
+#define VX_MAX_OUTPUT_GROUPS 64 // tx_groups entries per input (distinct load-balanced groups, shared IDs)
+#define VX_TX_GROUP_SIZE     16 // tx_group members, >= VX_MAX_OUTPUT_INTERFACES
+
+#define VX_VLAN_COUNT 4096 // VLAN IDs 0..4095, 4095 being the "any" selector
+#define VX_MAX_QINQ_RULES 1024 // (outer, inner) rules per input
+#define VX_QINQ_KEY(slot, outer, inner) (0x1000000 | ((slot) << 25) | ((outer) << 12) | (inner)) // qinq_* BPF maps key
+#define VX_MAX_FILTERS 64 // L3/L4 filters per input, IDs shared by every input, 0 meaning none
+#define VX_MAX_FILTER_PREFIXES 1024 // filter_src / filter_dst entries per input, one shared trie each
+#define VX_MAX_TUNNELS 16 // Remote SPAN tunnels per input, IDs shared by every input, 0 meaning none
+#define VX_CAPTURE_MAP "capture_ring"
+#define VX_CAPTURE_SNAPLEN 128 // Bytes copied from each captured frame
+#define VX_CAPTURE_RING_SIZE (1 << 20) // Default "ring_size" of the in-memory pcapng ring
+#define VX_CAPTURE_RING_MAX  (16 << 20) // Keeps the capture within the memory budget
+#define VX_CAPTURE_SUMMARY 16 // Packets listed by the capture view
+#define VX_CAPTURE_FILE "/capture.pcapng"
+#define VX_MIN_SNAPLEN 64 // Smallest accepted "snaplen", keeps at least the Ethernet and VLAN headers
+
 #define VX_REFRESH_TIME 100000000L // = 100M -> 10fps | max 1000000000ns = 1s +000
+#define VX_SAMPLE_PERIOD     100  // Default "sample_period_ms" of the sampler thread
+#define VX_SAMPLE_PERIOD_MIN 10
+#define VX_SAMPLE_PERIOD_MAX 1000
+#define VX_SAMPLE_RING 16       // Samples queued between the sampler thread and the UI
 
 #define VX_NETWORK_CHART_SIZE 800
 #define VX_CPU_CHART_SIZE 400
@@ -26,9 +50,14 @@
 #define VX_CONFIG_FILE      "/vxspan.json"
 #define VX_XDP_FILE         "/xdp_redirect.o"
 #define VX_XDP_PROG_SECTION "xdp_vlan_filter"
+#define VX_PIPELINE_MAP     "pipeline" // Tail-call stages after xdp_vlan_filter
+#define VX_STAGE_CLASSIFY 0 // L3/L4 match, dedup, sampling, capture, group hash
+#define VX_STAGE_ACTION   1 // Snaplen, tag and tunnel actions
+#define VX_PIPELINE_STAGES 2
 #define VX_XDP_HW  XDP_FLAGS_UPDATE_IF_NOEXIST|XDP_FLAGS_HW_MODE
 #define VX_XDP_DRV XDP_FLAGS_UPDATE_IF_NOEXIST|XDP_FLAGS_DRV_MODE
 #define VX_XDP_SKB XDP_FLAGS_UPDATE_IF_NOEXIST|XDP_FLAGS_SKB_MODE
+#define VX_XDP_AUTO 0 // DRV, SKB if DRV attach fails
 #define VX_XDP_MODE VX_XDP_SKB
 /* xdp_mode tested against vmxnet3 on vmware workstation 17.0x and esxi 7.x
  * => skb >> drv
@@ -37,7 +66,7 @@
 // UI
 #define VX_TITLE   "VxSpan"
 #define VX_VERSION "0.1.1"
-#define VX_FOOTNOTE "[b] bytes [p] packets [left/right] select interface [up/down/home/end] display vlan"
+#define VX_FOOTNOTE "[b] bytes [p] packets [left/right] select interface [up/down/home/end] display vlan [c] capture [w] save capture"
 
 #define VX_RED_PALETTE    lv_palette_main(LV_PALETTE_RED)
 #define VX_GREEN_PALETTE  lv_palette_main(LV_PALETTE_GREEN)
@@ -107,6 +136,77 @@ static lv_img_dsc_t png_image_dsc = {
 	.data = png_data
 };
 
+// XDP struct (vlan_redirect_map value)
+#define VX_VLAN_ACTION_RULE      0x1 // Slot has its own rule (not only the folded "any" rule)
+#define VX_VLAN_ACTION_BROADCAST 0x2 // Clone to every output of tx_sets[output_set]
+#define VX_VLAN_ACTION_SAMPLE_FLOW 0x4 // Sample on the flow hash instead of a random draw
+#define VX_VLAN_ACTION_GROUP       0x8 // One member of tx_groups[output_set] per flow
+#define VX_VLAN_ACTION_TAG_PUSH    0x10 // Push an 802.1Q tag with tag_vid
+#define VX_VLAN_ACTION_TAG_REWRITE 0x20 // Set the outer VID to tag_vid
+#define VX_VLAN_ACTION_TAG_STRIP   0x40 // Remove the outer tag
+#define VX_VLAN_ACTION_CAPTURE     0x80 // Copy the start of the frame to capture_ring
+struct vlan_action {
+	__u32 ifindex;
+	__u32 flags;
+	__u32 output_set;
+	__u32 snaplen; // 0 -> whole frame
+	__u32 sample_rate; // 0 or 1 -> every frame
+	__u32 filter; // filters index, 0 -> none
+	__u32 dedup_window; // us, 0 -> off
+	__u32 tag_vid;
+	__u32 tunnel; // tunnels index, 0 -> none
+};
+
+// XDP struct (capture_ring record)
+struct capture_record {
+	__u64 timestamp; // CLOCK_MONOTONIC ns
+	__u32 ifindex;
+	__u32 vlan_id;
+	__u32 len;
+	__u32 caplen;
+	__u8  data[VX_CAPTURE_SNAPLEN];
+};
+
+// XDP struct (tunnels value)
+#define VX_TUNNEL_GRE     1
+#define VX_TUNNEL_ERSPAN2 2
+#define VX_TUNNEL_ERSPAN3 3
+#define VX_TUNNEL_VXLAN   4
+#define VX_TUNNEL_HEADER_MAX 64
+struct tunnel {
+	__u32 type;
+	__u32 seq;
+	__u8  header[VX_TUNNEL_HEADER_MAX]; // Outer headers, lengths and checksum for an empty payload
+};
+
+// XDP struct (tx_groups value)
+struct tx_group {
+	__u32 count;
+	__u32 ifindex[VX_TX_GROUP_SIZE];
+};
+
+// XDP structs (filters value, filter_src / filter_dst key, filter_stats value)
+#define VX_FILTER_SRC   0x1
+#define VX_FILTER_DST   0x2
+#define VX_FILTER_PROTO 0x4
+struct vx_filter {
+	__u32 flags;
+	__u16 sport_min;
+	__u16 sport_max;
+	__u16 dport_min;
+	__u16 dport_max;
+	__u8  proto;
+};
+struct filter_key {
+	__u32 prefixlen; // 32 bits of filter ID + address prefix
+	__u32 filter;
+	__u32 addr[4];   // IPv6 or IPv4-mapped IPv6
+};
+struct filter_stat {
+	__u64 hits;
+	__u64 misses;
+};
+
 typedef enum {
 	VX_DISPLAY_NONE,
 	VX_DISPLAY_BYTES,
@@ -118,6 +218,7 @@ typedef struct Selector {
 	vx_display_mode display_mode;
 } Selector;
 
+bool config_headless();
 int load_configuration();
 void xdp_cleanup();
 
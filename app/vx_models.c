@@ -16,24 +16,15 @@
 #include "vx_network.h"
 #include "vx_utils.h"
 
-// Interfaces
-InterfaceCollection* init_interfaces() {
-    InterfaceCollection* collection = malloc(sizeof(InterfaceCollection));
-    if (!collection) {
-        perror("malloc failed");
-        return NULL;
-    }
-    collection->input_head  = NULL;
-    collection->output_head = NULL;
-    collection->input_count  = 0;
-    collection->output_count = 0;
+extern bool headless; // main
 
+// Interfaces
+static int interfaces_widgets(InterfaceCollection* collection) {
     // Chart
     lv_obj_t *network_label = lv_label_create(lv_scr_act());
     if (!network_label) {
         perror("lv_label_create allocation failed");
-        free(collection);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(network_label, 800, 16);
     lv_obj_set_style_text_align(network_label, LV_TEXT_ALIGN_CENTER, 0);
@@ -47,8 +38,7 @@ InterfaceCollection* init_interfaces() {
     if (!network_chart) {
         perror("lv_chart_create allocation failed");
         lv_obj_del(network_label);
-        free(collection);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(network_chart, 800, 192);
     lv_obj_align(network_chart, LV_ALIGN_TOP_MID, 0, 220);
@@ -67,8 +57,7 @@ InterfaceCollection* init_interfaces() {
         perror("lv_label_create allocation failed");
         lv_obj_del(network_chart);
         lv_obj_del(network_label);
-        free(collection);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(network_rx_label, 780, 16);
     lv_obj_set_style_text_align(network_rx_label, LV_TEXT_ALIGN_LEFT, 0);
@@ -84,8 +73,7 @@ InterfaceCollection* init_interfaces() {
         lv_obj_del(network_rx_label);
         lv_obj_del(network_chart);
         lv_obj_del(network_label);
-        free(collection);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(network_tx_label, 780, 16);
     lv_obj_set_style_text_align(network_tx_label, LV_TEXT_ALIGN_LEFT, 0);
@@ -102,8 +90,7 @@ InterfaceCollection* init_interfaces() {
         lv_obj_del(network_rx_label);
         lv_obj_del(network_chart);
         lv_obj_del(network_label);
-        free(collection);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(network_rxd_label, 780, 16);
     lv_obj_set_style_text_align(network_rxd_label, LV_TEXT_ALIGN_LEFT, 0);
@@ -121,8 +108,7 @@ InterfaceCollection* init_interfaces() {
         lv_obj_del(network_rx_label);
         lv_obj_del(network_chart);
         lv_obj_del(network_label);
-        free(collection);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(network_txd_label, 780, 16);
     lv_obj_set_style_text_align(network_txd_label, LV_TEXT_ALIGN_LEFT, 0);
@@ -131,32 +117,42 @@ InterfaceCollection* init_interfaces() {
     lv_obj_set_style_text_color(network_txd_label, VX_RED_PALETTE, 0);
     lv_obj_set_pos(network_txd_label, 8, 220 + 192 - 32 - 2);
     collection->network_txd_label = network_txd_label;
-
-    return collection;
+    return 0;
 }
 
-Interface* add_input_interface(InterfaceCollection* collection, int if_index, const char* interface_name) {
-    Interface* new_interface = malloc(sizeof(Interface));
-    if (!new_interface) {
+InterfaceCollection* init_interfaces() {
+    InterfaceCollection* collection = malloc(sizeof(InterfaceCollection));
+    if (!collection) {
         perror("malloc failed");
         return NULL;
     }
-    new_interface->type = VX_CLASS_INPUT_INTERFACE;
-    new_interface->parent = collection;
-    new_interface->if_index = if_index;
-    strncpy(new_interface->interface_name, interface_name, IFNAMSIZ);
-    init_circular_buffer(&new_interface->buffer);
-    new_interface->vlan_stats = NULL;
-    new_interface->next = NULL;
-    new_interface->prev = NULL;
+    collection->input_head  = NULL;
+    collection->output_head = NULL;
+    collection->input_count  = 0;
+    collection->output_count = 0;
 
+    // Widgets, none in headless mode
+    collection->network_chart     = NULL;
+    collection->network_label     = NULL;
+    collection->network_rx_label  = NULL;
+    collection->network_tx_label  = NULL;
+    collection->network_rxd_label = NULL;
+    collection->network_txd_label = NULL;
+    if (!headless && interfaces_widgets(collection) < 0) {
+        free(collection);
+        return NULL;
+    }
+
+    return collection;
+}
+
+static int input_interface_widgets(InterfaceCollection* collection, Interface* new_interface) {
     lv_obj_t* name = lv_label_create(lv_scr_act());
     if (!name) {
         perror("lv_label_create allocation failed");
-        free(new_interface);
-        return NULL;
+        return -1;
     }
-    lv_label_set_text(name, interface_name);
+    lv_label_set_text(name, new_interface->interface_name);
     lv_obj_set_size(name, 66, 16);
     lv_obj_set_style_text_align(name, LV_TEXT_ALIGN_CENTER, 0);
     lv_obj_set_style_text_font(name, &lv_font_montserrat_14, 0);
@@ -168,8 +164,7 @@ Interface* add_input_interface(InterfaceCollection* collection, int if_index, co
     if (!image) {
         perror("lv_img_create allocation failed");
         lv_obj_del(name);
-        free(new_interface);
-        return NULL;
+        return -1;
     }
     lv_img_set_src(image, &png_image_dsc);
     lv_obj_set_style_border_post(image, true, 0);
@@ -182,8 +177,7 @@ Interface* add_input_interface(InterfaceCollection* collection, int if_index, co
         perror("lv_label_create allocation failed");
         lv_obj_del(image);
         lv_obj_del(name);
-        free(new_interface);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(status, 64, 16);
     lv_obj_set_style_text_align(status, LV_TEXT_ALIGN_CENTER, 0);
@@ -197,8 +191,7 @@ Interface* add_input_interface(InterfaceCollection* collection, int if_index, co
         lv_obj_del(status);
         lv_obj_del(image);
         lv_obj_del(name);
-        free(new_interface);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(xdp_mode, 64, 16);
     lv_obj_set_style_text_align(xdp_mode, LV_TEXT_ALIGN_CENTER, 0);
@@ -212,95 +205,47 @@ Interface* add_input_interface(InterfaceCollection* collection, int if_index, co
     lv_obj_set_pos(new_interface->status,   2 + collection->input_count * 68, 48);
     lv_obj_set_pos(new_interface->image,   15 + collection->input_count * 68, 63);
     lv_obj_set_pos(new_interface->xdp_mode, 2 + collection->input_count * 68, 72);
+    return 0;
+}
 
-    Interface_refresh(new_interface);
-
-    lv_chart_series_t* rx_bytes = lv_chart_add_series(collection->network_chart, VX_INPUT_RX_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!rx_bytes) {
-        perror("lv_chart_add_series allocation failed");
-        lv_obj_del(xdp_mode);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
-        return NULL;
-    }
-    new_interface->rx_bytes = rx_bytes;
-
-    lv_chart_series_t* rx_packets = lv_chart_add_series(collection->network_chart, VX_INPUT_RX_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!rx_packets) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(xdp_mode);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
-        return NULL;
-    }
-    new_interface->rx_packets = rx_packets;
-
-    lv_chart_series_t* rx_dropped = lv_chart_add_series(collection->network_chart, VX_INPUT_RXD_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!rx_dropped) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, rx_packets);
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(xdp_mode);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
+Interface* add_input_interface(InterfaceCollection* collection, int if_index, const char* interface_name) {
+    Interface* new_interface = malloc(sizeof(Interface));
+    if (!new_interface) {
+        perror("malloc failed");
         return NULL;
     }
-    new_interface->rx_dropped = rx_dropped;
+    new_interface->type = VX_CLASS_INPUT_INTERFACE;
+    new_interface->xdp_flags = VX_XDP_MODE;
+    new_interface->input_slot = collection->input_count;
+    new_interface->parent = collection;
+    new_interface->if_index = if_index;
+    strncpy(new_interface->interface_name, interface_name, IFNAMSIZ);
+    init_circular_buffer(&new_interface->buffer);
+    new_interface->vlan_stats = NULL;
+    new_interface->next = NULL;
+    new_interface->prev = NULL;
 
-    lv_chart_series_t* tx_bytes = lv_chart_add_series(collection->network_chart, VX_INPUT_TX_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!tx_bytes) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, rx_dropped);
-        lv_chart_remove_series(collection->network_chart, rx_packets);
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(xdp_mode);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
+    // Widgets, none in headless mode
+    new_interface->name     = NULL;
+    new_interface->image    = NULL;
+    new_interface->status   = NULL;
+    new_interface->xdp_mode = NULL;
+    if (!headless && input_interface_widgets(collection, new_interface) < 0) {
         free(new_interface);
         return NULL;
     }
-    new_interface->tx_bytes = tx_bytes;
 
-    lv_chart_series_t* tx_packets = lv_chart_add_series(collection->network_chart, VX_INPUT_TX_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!tx_packets) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, tx_bytes);
-        lv_chart_remove_series(collection->network_chart, rx_dropped);
-        lv_chart_remove_series(collection->network_chart, rx_packets);
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(xdp_mode);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
-        return NULL;
-    }
-    new_interface->tx_packets = tx_packets;
+    Interface_refresh(new_interface);
 
-    lv_chart_series_t* tx_dropped = lv_chart_add_series(collection->network_chart, VX_INPUT_TXD_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!tx_dropped) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, tx_packets);
-        lv_chart_remove_series(collection->network_chart, tx_bytes);
-        lv_chart_remove_series(collection->network_chart, rx_dropped);
-        lv_chart_remove_series(collection->network_chart, rx_packets);
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(xdp_mode);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
-        return NULL;
-    }
-    new_interface->tx_dropped = tx_dropped;
+    // Chart series are only built while shown (Interface_set_focus)
+    new_interface->rx_bytes   = NULL;
+    new_interface->rx_packets = NULL;
+    new_interface->rx_dropped = NULL;
+    new_interface->tx_bytes   = NULL;
+    new_interface->tx_packets = NULL;
+    new_interface->tx_dropped = NULL;
+    new_interface->bytes_scale   = -1;
+    new_interface->packets_scale = -1;
 
     // Insert
     if (collection->input_head == NULL) {
@@ -330,41 +275,18 @@ Interface* add_input_interface(InterfaceCollection* collection, int if_index, co
         }
     }
 
-    if(collection->input_count > 0) {
-        lv_chart_hide_series(collection->network_chart, rx_bytes, true);
-        lv_chart_hide_series(collection->network_chart, rx_packets, true);
-        lv_chart_hide_series(collection->network_chart, rx_dropped, true);
-        lv_chart_hide_series(collection->network_chart, tx_bytes, true);
-        lv_chart_hide_series(collection->network_chart, tx_packets, true);
-        lv_chart_hide_series(collection->network_chart, tx_dropped, true);
-    }
 
     collection->input_count++;
     return new_interface;
 }
 
-Interface* add_output_interface(InterfaceCollection* collection, int if_index, const char* interface_name) {
-    Interface* new_interface = malloc(sizeof(Interface));
-    if (!new_interface) {
-        perror("malloc failed");
-        return NULL;
-    }
-    new_interface->type = VX_CLASS_OUTPUT_INTERFACE;
-    new_interface->parent = collection;
-    new_interface->if_index = if_index;
-    strncpy(new_interface->interface_name, interface_name, IFNAMSIZ);
-    init_circular_buffer(&new_interface->buffer);
-    new_interface->vlan_stats = NULL;
-    new_interface->next = NULL;
-    new_interface->prev = NULL;
-
+static int output_interface_widgets(Interface* new_interface) {
     lv_obj_t* name = lv_label_create(lv_scr_act());
     if (!name) {
         perror("lv_label_create allocation failed");
-        free(new_interface);
-        return NULL;
+        return -1;
     }
-    lv_label_set_text(name, interface_name);
+    lv_label_set_text(name, new_interface->interface_name);
     lv_obj_set_size(name, 66, 16);
     lv_obj_set_style_text_align(name, LV_TEXT_ALIGN_CENTER, 0);
     lv_obj_set_style_text_font(name, &lv_font_montserrat_14, 0);
@@ -376,8 +298,7 @@ Interface* add_output_interface(InterfaceCollection* collection, int if_index, c
     if (!image) {
         perror("lv_img_create allocation failed");
         lv_obj_del(name);
-        free(new_interface);
-        return NULL;
+        return -1;
     }
     lv_img_set_src(image, &png_image_dsc);
     lv_obj_set_style_border_post(image, true, 0);
@@ -390,106 +311,52 @@ Interface* add_output_interface(InterfaceCollection* collection, int if_index, c
         perror("lv_label_create allocation failed");
         lv_obj_del(image);
         lv_obj_del(name);
-        free(new_interface);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(status, 64, 16);
     lv_obj_set_style_text_align(status, LV_TEXT_ALIGN_CENTER, 0);
     lv_obj_set_style_text_font(status, &lv_font_montserrat_14, 0);
     lv_obj_set_style_text_letter_space(status, -1, 0);
     new_interface->status = status;
+    return 0;
+}
 
-    Interface_refresh(new_interface);
-
-    lv_chart_series_t* rx_bytes = lv_chart_add_series(collection->network_chart, VX_OUTPUT_RX_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!rx_bytes) {
-        perror("lv_chart_add_series allocation failed");
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
-        return NULL;
-    }
-    new_interface->rx_bytes = rx_bytes;
-
-    lv_chart_series_t* rx_packets = lv_chart_add_series(collection->network_chart, VX_OUTPUT_RX_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!rx_packets) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
-        return NULL;
-    }
-    new_interface->rx_packets = rx_packets;
-
-    lv_chart_series_t* rx_dropped = lv_chart_add_series(collection->network_chart, VX_OUTPUT_RXD_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!rx_dropped) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, rx_packets);
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
-        return NULL;
-    }
-    new_interface->rx_dropped = rx_dropped;
-
-    lv_chart_series_t* tx_bytes = lv_chart_add_series(collection->network_chart, VX_OUTPUT_TX_COLOR,   LV_CHART_AXIS_PRIMARY_Y);
-    if (!tx_bytes) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, rx_dropped);
-        lv_chart_remove_series(collection->network_chart, rx_packets);
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
+Interface* add_output_interface(InterfaceCollection* collection, int if_index, const char* interface_name) {
+    Interface* new_interface = malloc(sizeof(Interface));
+    if (!new_interface) {
+        perror("malloc failed");
         return NULL;
     }
-    new_interface->tx_bytes = tx_bytes;
+    new_interface->type = VX_CLASS_OUTPUT_INTERFACE;
+    new_interface->parent = collection;
+    new_interface->if_index = if_index;
+    strncpy(new_interface->interface_name, interface_name, IFNAMSIZ);
+    init_circular_buffer(&new_interface->buffer);
+    new_interface->vlan_stats = NULL;
+    new_interface->next = NULL;
+    new_interface->prev = NULL;
 
-    lv_chart_series_t* tx_packets = lv_chart_add_series(collection->network_chart, VX_OUTPUT_TX_COLOR,   LV_CHART_AXIS_PRIMARY_Y);
-    if (!tx_packets) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, tx_bytes);
-        lv_chart_remove_series(collection->network_chart, rx_dropped);
-        lv_chart_remove_series(collection->network_chart, rx_packets);
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
+    // Widgets, none in headless mode
+    new_interface->name     = NULL;
+    new_interface->image    = NULL;
+    new_interface->status   = NULL;
+    new_interface->xdp_mode = NULL;
+    if (!headless && output_interface_widgets(new_interface) < 0) {
         free(new_interface);
         return NULL;
     }
-    new_interface->tx_packets = tx_packets;
 
-    lv_chart_series_t* tx_dropped = lv_chart_add_series(collection->network_chart, VX_OUTPUT_TXD_COLOR,   LV_CHART_AXIS_PRIMARY_Y);
-    if (!tx_dropped) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(collection->network_chart, tx_packets);
-        lv_chart_remove_series(collection->network_chart, tx_bytes);
-        lv_chart_remove_series(collection->network_chart, rx_dropped);
-        lv_chart_remove_series(collection->network_chart, rx_packets);
-        lv_chart_remove_series(collection->network_chart, rx_bytes);
-        lv_obj_del(status);
-        lv_obj_del(image);
-        lv_obj_del(name);
-        free(new_interface);
+    Interface_refresh(new_interface);
 
-        return NULL;
-    }
-    new_interface->tx_dropped = tx_dropped;
-    if(collection->input_count > 0) {
-        lv_chart_hide_series(collection->network_chart, rx_bytes, true);
-        lv_chart_hide_series(collection->network_chart, rx_packets, true);
-        lv_chart_hide_series(collection->network_chart, rx_dropped, true);
-        lv_chart_hide_series(collection->network_chart, tx_bytes, true);
-        lv_chart_hide_series(collection->network_chart, tx_packets, true);
-        lv_chart_hide_series(collection->network_chart, tx_dropped, true);
-    }
+    // Chart series are only built while shown (Interface_set_focus)
+    new_interface->rx_bytes   = NULL;
+    new_interface->rx_packets = NULL;
+    new_interface->rx_dropped = NULL;
+    new_interface->tx_bytes   = NULL;
+    new_interface->tx_packets = NULL;
+    new_interface->tx_dropped = NULL;
+    new_interface->bytes_scale   = -1;
+    new_interface->packets_scale = -1;
 
     // Insert
     if (collection->output_head == NULL) {
@@ -530,16 +397,20 @@ Interface* add_output_interface(InterfaceCollection* collection, int if_index, c
 }
 
 void Interface_up(Interface* interface) {
+    interface->is_up = true;
+    if (!interface->status)
+        return;
     lv_obj_set_style_border_color(interface->image, VX_GREEN_PALETTE, 0);
     lv_label_set_text(interface->status, "<UP>");
     lv_obj_set_style_text_color(interface->status, VX_GREEN_PALETTE, 0);
-    interface->is_up = true;
 }
 void Interface_down(Interface* interface) {
+    interface->is_up = false;
+    if (!interface->status)
+        return;
     lv_obj_set_style_border_color(interface->image, VX_RED_PALETTE, 0);
     lv_label_set_text(interface->status, "<DOWN>");
     lv_obj_set_style_text_color(interface->status, VX_RED_PALETTE, 0);
-    interface->is_up = false;
 }
 void Interface_refresh(Interface* interface) {
     if (interface)
@@ -549,7 +420,25 @@ void Interface_refresh(Interface* interface) {
             Interface_down(interface);
         }
 }
+// Chart series only exist while shown, hundreds of VLANs don't each hold
+// their own point arrays
+static int series_show(lv_obj_t* chart, lv_chart_series_t** series, lv_color_t color, bool shown) {
+    if (shown && !*series) {
+        *series = lv_chart_add_series(chart, color, LV_CHART_AXIS_PRIMARY_Y);
+        if (!*series) {
+            perror("lv_chart_add_series allocation failed");
+            return -1;
+        }
+    } else if (!shown && *series) {
+        lv_chart_remove_series(chart, *series);
+        *series = NULL;
+    }
+    return 0;
+}
+
 int Interface_set_focus(Interface* interface, bool focus, vx_display_mode mode) {
+    if (!interface->image)
+        return 0;
     lv_obj_set_style_image_opa(interface->image, focus ? LV_OPA_100 : LV_OPA_50, 0);
     if (focus) {
         char interface_name[IFNAMSIZ];
@@ -560,34 +449,41 @@ int Interface_set_focus(Interface* interface, bool focus, vx_display_mode mode)
         lv_label_set_text(interface->name, interface_name);
     }
     lv_obj_set_style_bg_opa(interface->name, !focus ? LV_OPA_0 : LV_OPA_50, 0);
-    lv_chart_hide_series(interface->parent->network_chart, interface->rx_bytes, !(focus && (mode == VX_DISPLAY_BYTES)));
-    lv_chart_hide_series(interface->parent->network_chart, interface->tx_bytes, !(focus && (mode == VX_DISPLAY_BYTES)));
-    lv_chart_hide_series(interface->parent->network_chart, interface->rx_packets, !(focus && (mode == VX_DISPLAY_PACKETS)));
-    lv_chart_hide_series(interface->parent->network_chart, interface->tx_packets, !(focus && (mode == VX_DISPLAY_PACKETS)));
-    lv_chart_hide_series(interface->parent->network_chart, interface->rx_dropped, !(focus && (mode == VX_DISPLAY_PACKETS)));
-    lv_chart_hide_series(interface->parent->network_chart, interface->tx_dropped, !(focus && (mode == VX_DISPLAY_PACKETS)));
+    lv_obj_t* chart = interface->parent->network_chart;
+    bool input   = interface->type == VX_CLASS_INPUT_INTERFACE;
+    bool bytes   = focus && mode == VX_DISPLAY_BYTES;
+    bool packets = focus && mode == VX_DISPLAY_PACKETS;
+    if (series_show(chart, &interface->rx_bytes,   input ? VX_INPUT_RX_COLOR  : VX_OUTPUT_RX_COLOR,  bytes)   < 0
+        || series_show(chart, &interface->tx_bytes,   input ? VX_INPUT_TX_COLOR  : VX_OUTPUT_TX_COLOR,  bytes)   < 0
+        || series_show(chart, &interface->rx_packets, input ? VX_INPUT_RX_COLOR  : VX_OUTPUT_RX_COLOR,  packets) < 0
+        || series_show(chart, &interface->tx_packets, input ? VX_INPUT_TX_COLOR  : VX_OUTPUT_TX_COLOR,  packets) < 0
+        || series_show(chart, &interface->rx_dropped, input ? VX_INPUT_RXD_COLOR : VX_OUTPUT_RXD_COLOR, packets) < 0
+        || series_show(chart, &interface->tx_dropped, input ? VX_INPUT_TXD_COLOR : VX_OUTPUT_TXD_COLOR, packets) < 0)
+        return -1;
+    // New series are filled from the history by the next series update
+    interface->bytes_scale = interface->packets_scale = -1;
     return 0;
 }
 
 void OutputInterface_position(Interface* interface, int i) {
+    if (!interface->image)
+        return;
     lv_obj_set_pos(interface->image,  745 - i * 68, 133);
     lv_obj_set_pos(interface->status, 732 - i * 68, 169);
     lv_obj_set_pos(interface->name,   732 - i * 68, 184);
 }
 
 void update_interface_data(Interface* interface, InterfaceStats interface_stats) {
-    // Insert new values
-    add_data_to_buffer(&interface->buffer, interface_stats);
-    // Compute SMA
-    interface_update_sma(interface);
+    // Insert new values, SMA and max follow in constant time
+    interface_update_sma(interface, interface_stats);
 }
 
-Vlan* add_or_update_vlan(Interface* interface, int vlan_id) {
+Vlan* add_or_update_vlan(Interface* interface, int vlan_id, int inner_vlan_id) {
     Vlan* current = interface->vlan_stats;
 
     // Search for existing VLAN stats
     while (current != NULL) {
-        if (current->vlan_id == vlan_id) {
+        if (current->vlan_id == vlan_id && current->inner_vlan_id == inner_vlan_id) {
             return current;
         }
         current = current->next;
@@ -602,81 +498,21 @@ Vlan* add_or_update_vlan(Interface* interface, int vlan_id) {
     new_vlan->type = VX_CLASS_VLAN;
     new_vlan->parent = interface;
     new_vlan->vlan_id = vlan_id;
+    new_vlan->inner_vlan_id = inner_vlan_id;
     init_circular_buffer(&new_vlan->buffer);
 
-    lv_chart_series_t* tmp_rx_bytes = lv_chart_add_series(interface->parent->network_chart, VX_VLAN_RX_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!tmp_rx_bytes) {
-        perror("lv_chart_add_series allocation failed");
-        free(new_vlan);
-        return NULL;
-    }
-    new_vlan->rx_bytes = tmp_rx_bytes;
-
-    lv_chart_series_t* tmp_rx_packets = lv_chart_add_series(interface->parent->network_chart, VX_VLAN_RX_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!tmp_rx_packets) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(interface->parent->network_chart, tmp_rx_bytes);
-        free(new_vlan);
-        return NULL;
-    }
-    new_vlan->rx_packets = tmp_rx_packets;
-
-    lv_chart_series_t* tmp_rx_dropped = lv_chart_add_series(interface->parent->network_chart, VX_VLAN_RXD_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!tmp_rx_dropped) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(interface->parent->network_chart, tmp_rx_packets);
-        lv_chart_remove_series(interface->parent->network_chart, tmp_rx_bytes);
-        free(new_vlan);
-        return NULL;
-    }
-    new_vlan->rx_dropped = tmp_rx_dropped;
-
-    lv_chart_series_t* tmp_rx_dropped_bytes = lv_chart_add_series(interface->parent->network_chart, VX_VLAN_RXD_COLOR, LV_CHART_AXIS_PRIMARY_Y);
-    if (!tmp_rx_dropped_bytes) {
-        perror("lv_chart_add_series allocation failed");
-        lv_chart_remove_series(interface->parent->network_chart, tmp_rx_dropped);
-        lv_chart_remove_series(interface->parent->network_chart, tmp_rx_packets);
-        lv_chart_remove_series(interface->parent->network_chart, tmp_rx_bytes);
-        free(new_vlan);
-        return NULL;
-    }
-    new_vlan->rx_dropped_bytes = tmp_rx_dropped_bytes;
-
-    // Lookup redirection for VLAN on interface
-    new_vlan->redirection = NULL;
-    int redirection_index;
-    if (bpf_map_lookup_elem(interface->vlan_redirect_map_fd, &vlan_id, &redirection_index) < 0)
-        if (errno == ENOENT)
-            redirection_index = -1;
-        else {
-            perror("bpf_map_lookup_elem");
-            lv_chart_remove_series(interface->parent->network_chart, tmp_rx_dropped_bytes);
-            lv_chart_remove_series(interface->parent->network_chart, tmp_rx_dropped);
-            lv_chart_remove_series(interface->parent->network_chart, tmp_rx_packets);
-            lv_chart_remove_series(interface->parent->network_chart, tmp_rx_bytes);
-            free(new_vlan);
-            return NULL;
-        }
-    if (redirection_index > 0) {
-        Interface* redirection = interface->parent->output_head;
-        while (redirection != NULL) {
-            if (redirection->if_index == redirection_index) {
-                new_vlan->redirection = redirection;
-                break;
-            }
-            redirection = redirection->next;
-        }
-    }
+    // Chart series are only built while shown (Vlan_set_focus)
+    new_vlan->rx_bytes         = NULL;
+    new_vlan->rx_packets       = NULL;
+    new_vlan->rx_dropped_bytes = NULL;
+    new_vlan->rx_dropped       = NULL;
+    new_vlan->bytes_scale   = -1;
+    new_vlan->packets_scale = -1;
 
-    if (new_vlan->parent && new_vlan->redirection) {
-        new_vlan->line = lv_line_create(lv_scr_act());
-        lv_obj_set_style_line_rounded(new_vlan->line, true, 0);
-        lv_obj_set_style_line_width(new_vlan->line, 3, 0);
-
-        Vlan_reposition(new_vlan);
-        Vlan_refresh(new_vlan);
-        Vlan_set_focus(new_vlan, false, VX_DISPLAY_NONE);
-    }
+    // Redirections are linked by the configuration (Vlan_add_redirection)
+    new_vlan->redirection_count = 0;
+    new_vlan->prev = NULL;
+    new_vlan->next = NULL;
 
     // Insert
     if (interface->vlan_stats == NULL) {
@@ -685,7 +521,8 @@ Vlan* add_or_update_vlan(Interface* interface, int vlan_id) {
         Vlan* current = interface->vlan_stats;
         Vlan* previous = NULL;
 
-        while (current != NULL && current->vlan_id < vlan_id) {
+        while (current != NULL && (current->vlan_id < vlan_id
+                || (current->vlan_id == vlan_id && current->inner_vlan_id < inner_vlan_id))) {
             previous = current;
             current = current->next;
         }
@@ -710,43 +547,78 @@ Vlan* add_or_update_vlan(Interface* interface, int vlan_id) {
     return new_vlan;
 }
 
+int Vlan_add_redirection(Vlan* vlan, Interface* redirection) {
+    for (int i = 0; i < vlan->redirection_count; i++)
+        if (vlan->redirections[i] == redirection)
+            return 0;
+    if (vlan->redirection_count >= VX_MAX_OUTPUT_INTERFACES) {
+        perror("Too many redirections for VLAN");
+        return -1;
+    }
+    lv_obj_t* line = NULL;
+    if (!headless) {
+        line = lv_line_create(lv_scr_act());
+        if (!line) {
+            perror("lv_line_create allocation failed");
+            return -1;
+        }
+        lv_obj_set_style_line_rounded(line, true, 0);
+        lv_obj_set_style_line_width(line, 3, 0);
+    }
+    vlan->redirections[vlan->redirection_count] = redirection;
+    vlan->lines[vlan->redirection_count] = line;
+    vlan->redirection_count++;
+
+    Vlan_reposition(vlan);
+    Vlan_refresh(vlan);
+    return Vlan_set_focus(vlan, false, VX_DISPLAY_NONE);
+}
+
 void Vlan_reposition(Vlan* vlan) {
-    if (vlan->parent && vlan->redirection) {
+    if (!vlan->parent->image)
+        return;
+    for (int i = 0; i < vlan->redirection_count; i++) {
+        Interface *redirection = vlan->redirections[i];
         lv_obj_update_layout(vlan->parent->image);
-        lv_obj_update_layout(vlan->redirection->image);
+        lv_obj_update_layout(redirection->image);
 
         int input_x  = (lv_obj_get_x(vlan->parent->image)+lv_obj_get_x2(vlan->parent->image))/2;
-        int output_x = (lv_obj_get_x(vlan->redirection->image)+lv_obj_get_x2(vlan->redirection->image))/2;
+        int output_x = (lv_obj_get_x(redirection->image)+lv_obj_get_x2(redirection->image))/2;
         int outindex = 0;
-        Interface *output = vlan->redirection;
+        Interface *output = redirection;
         while (output->next) {
             outindex++;
             output = output->next;
         }
-        vlan->points[0].x = input_x;
-        vlan->points[0].y = 98;
-        vlan->points[1].x = input_x;
-        vlan->points[1].y = 125 - outindex * 5;
-        vlan->points[2].x = output_x;
-        vlan->points[2].y = 125 - outindex * 5;
-        vlan->points[3].x = output_x;
-        vlan->points[3].y = 133;
-
-        lv_line_set_points(vlan->line, vlan->points, 4);
-        lv_obj_update_layout(vlan->line);
+        lv_point_precise_t *points = vlan->points[i];
+        points[0].x = input_x;
+        points[0].y = 98;
+        points[1].x = input_x;
+        points[1].y = 125 - outindex * 5;
+        points[2].x = output_x;
+        points[2].y = 125 - outindex * 5;
+        points[3].x = output_x;
+        points[3].y = 133;
+
+        lv_line_set_points(vlan->lines[i], points, 4);
+        lv_obj_update_layout(vlan->lines[i]);
     }
 }
 void Vlan_refresh(Vlan* vlan) {
-    if (vlan->parent && vlan->redirection) {
-        if (vlan->parent->is_up && vlan->redirection->is_up)
-            lv_obj_set_style_line_color(vlan->line, VX_GREEN_PALETTE, 0);
+    for (int i = 0; i < vlan->redirection_count; i++) {
+        if (!vlan->lines[i])
+            continue;
+        if (vlan->parent->is_up && vlan->redirections[i]->is_up)
+            lv_obj_set_style_line_color(vlan->lines[i], VX_GREEN_PALETTE, 0);
         else
-            lv_obj_set_style_line_color(vlan->line, VX_ORANGE_PALETTE, 0);
+            lv_obj_set_style_line_color(vlan->lines[i], VX_ORANGE_PALETTE, 0);
     }
 }
 int Vlan_set_focus(Vlan* vlan, bool focus, vx_display_mode mode) {
-    if (vlan->line)
-        lv_obj_set_style_line_opa(vlan->line, focus ? LV_OPA_100 : LV_OPA_50, 0);
+    if (!vlan->parent->name)
+        return 0;
+    for (int i = 0; i < vlan->redirection_count; i++)
+        lv_obj_set_style_line_opa(vlan->lines[i], focus ? LV_OPA_100 : LV_OPA_50, 0);
     // lv_obj_set_style_bg_opa(vlan->name, focus ? LV_OPA_100 : LV_OPA_50, 0);
     lv_obj_set_style_bg_opa(vlan->parent->name, !focus ? LV_OPA_0 : LV_OPA_50, 0);
     if (focus) {
@@ -755,60 +627,52 @@ int Vlan_set_focus(Vlan* vlan, bool focus, vx_display_mode mode) {
             perror("if_indextoname");
             return -1;
         }
-        lv_label_set_text_fmt(vlan->parent->name, "%s.%d", interface_name, vlan->vlan_id);
-    }
-    lv_chart_hide_series(vlan->parent->parent->network_chart, vlan->rx_bytes,         !(focus && (mode == VX_DISPLAY_BYTES)));
-    lv_chart_hide_series(vlan->parent->parent->network_chart, vlan->rx_dropped_bytes, !(focus && (mode == VX_DISPLAY_BYTES)));
-    lv_chart_hide_series(vlan->parent->parent->network_chart, vlan->rx_packets, !(focus && (mode == VX_DISPLAY_PACKETS)));
-    lv_chart_hide_series(vlan->parent->parent->network_chart, vlan->rx_dropped, !(focus && (mode == VX_DISPLAY_PACKETS)));
+        if (vlan->inner_vlan_id < 0)
+            lv_label_set_text_fmt(vlan->parent->name, "%s.%d", interface_name, vlan->vlan_id);
+        else
+            lv_label_set_text_fmt(vlan->parent->name, "%s.%d.%d", interface_name, vlan->vlan_id, vlan->inner_vlan_id);
+    }
+    lv_obj_t* chart = vlan->parent->parent->network_chart;
+    bool bytes   = focus && mode == VX_DISPLAY_BYTES;
+    bool packets = focus && mode == VX_DISPLAY_PACKETS;
+    if (series_show(chart, &vlan->rx_bytes,         VX_VLAN_RX_COLOR,  bytes)   < 0
+        || series_show(chart, &vlan->rx_dropped_bytes, VX_VLAN_RXD_COLOR, bytes)   < 0
+        || series_show(chart, &vlan->rx_packets,       VX_VLAN_RX_COLOR,  packets) < 0
+        || series_show(chart, &vlan->rx_dropped,       VX_VLAN_RXD_COLOR, packets) < 0)
+        return -1;
+    // New series are filled from the history by the next series update
+    vlan->bytes_scale = vlan->packets_scale = -1;
     return 0;
 }
 void Vlan_visible(Vlan* vlan, const bool state) {
-    if (vlan->line)
+    for (int i = 0; i < vlan->redirection_count; i++) {
+        if (!vlan->lines[i])
+            continue;
         if (state)
-            lv_obj_add_flag(vlan->line, LV_OBJ_FLAG_HIDDEN);
-        else {
-            lv_obj_remove_flag(vlan->line, LV_OBJ_FLAG_HIDDEN);
-            Vlan_refresh(vlan);
-        }
+            lv_obj_add_flag(vlan->lines[i], LV_OBJ_FLAG_HIDDEN);
+        else
+            lv_obj_remove_flag(vlan->lines[i], LV_OBJ_FLAG_HIDDEN);
+    }
+    if (!state)
+        Vlan_refresh(vlan);
 }
 
 void update_vlan_data(Vlan* vlan, InterfaceStats interface_stats) {
-    add_data_to_buffer(&vlan->buffer, interface_stats);
-    // Compute SMA
-    vlan_update_sma(vlan);
+    // Insert new values, SMA and max follow in constant time
+    vlan_update_sma(vlan, interface_stats);
 }
 
 int init_circular_buffer(InterfaceBuffer* buffer) {
-    memset(buffer->data, 0, sizeof(buffer->data));
-    buffer->head = 0;
-    buffer->count = 0;
+    memset(buffer, 0, sizeof(*buffer));
     return 0;
 }
 
-void add_data_to_buffer(InterfaceBuffer* buffer, InterfaceStats interface_stats) {
-    buffer->data[buffer->head] = interface_stats;
-    buffer->head = (buffer->head + 1) % (VX_NETWORK_CHART_SIZE + 1);
-    if (buffer->count < (VX_NETWORK_CHART_SIZE + 1)) {
-        buffer->count++;
-    }
-}
-
 // Cpu
-CpuCollection* init_cpus() {
-    CpuCollection* collection = malloc(sizeof(CpuCollection));
-    if (!collection) {
-        perror("malloc failed");
-        return NULL;
-    }
-    collection->head  = NULL;
-    collection->count = 0;
-
+static int cpus_widgets(CpuCollection* collection) {
     lv_obj_t* cpus_label = lv_label_create(lv_scr_act());
     if (!cpus_label) {
         perror("lv_label_create allocation failed");
-        free(collection);
-        return NULL;
+        return -1;
     }
     lv_label_set_text(cpus_label, "CPU usage");
     lv_obj_set_size(cpus_label, 396, 16);
@@ -823,8 +687,7 @@ CpuCollection* init_cpus() {
     if (!cpus_chart) {
         perror("lv_obj_create allocation failed");
         lv_obj_del(cpus_label);
-        free(collection);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(cpus_chart, 396, 128);
     lv_obj_align(cpus_chart, LV_ALIGN_TOP_LEFT, 0, 432);
@@ -837,33 +700,44 @@ CpuCollection* init_cpus() {
     lv_obj_set_style_pad_all(cpus_chart, 0, 0);
     lv_chart_set_point_count(cpus_chart, VX_CPU_CHART_SIZE);
     collection->cpus_chart = cpus_chart;
+    return 0;
+}
+
+CpuCollection* init_cpus() {
+    CpuCollection* collection = malloc(sizeof(CpuCollection));
+    if (!collection) {
+        perror("malloc failed");
+        return NULL;
+    }
+    collection->head  = NULL;
+    collection->count = 0;
+
+    // Widgets, none in headless mode
+    collection->cpus_label = NULL;
+    collection->cpus_chart = NULL;
+    if (!headless && cpus_widgets(collection) < 0) {
+        free(collection);
+        return NULL;
+    }
 
     int cpus_count = sysconf(_SC_NPROCESSORS_ONLN);
     for (int i = 0; i < cpus_count; i++)
         if(!add_cpu(collection, i)) {
-            lv_obj_del(cpus_chart);
-            lv_obj_del(cpus_label);
+            if (collection->cpus_chart) {
+                lv_obj_del(collection->cpus_chart);
+                lv_obj_del(collection->cpus_label);
+            }
             free(collection);
             return NULL;
         }
 
     return collection;
 }
-Cpu* add_cpu(CpuCollection* collection, int id) {
-    static int i = 0;
-    Cpu* new_cpu = malloc(sizeof(Cpu));
-    if (!new_cpu) {
-        perror("malloc failed");
-        return NULL;
-    }
-    new_cpu->parent = collection;
-    new_cpu->id = id;
-
+static int cpu_widgets(CpuCollection* collection, Cpu* new_cpu, int id, int i) {
     lv_obj_t* cpu_label = lv_label_create(lv_scr_act());
     if (!cpu_label) {
         perror("lv_label_create allocation failed");
-        free(new_cpu);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(cpu_label, 95, 32);
     lv_obj_set_style_text_align(cpu_label, LV_TEXT_ALIGN_CENTER, 0);
@@ -877,10 +751,29 @@ Cpu* add_cpu(CpuCollection* collection, int id) {
     if (!cpu_load) {
         perror("lv_chart_add_series allocation failed");
         lv_chart_remove_series(collection->cpus_chart, cpu_load);
+        return -1;
+    }
+    new_cpu->cpu_load = cpu_load;
+    return 0;
+}
+
+Cpu* add_cpu(CpuCollection* collection, int id) {
+    static int i = 0;
+    Cpu* new_cpu = malloc(sizeof(Cpu));
+    if (!new_cpu) {
+        perror("malloc failed");
+        return NULL;
+    }
+    new_cpu->parent = collection;
+    new_cpu->id = id;
+
+    // Widgets, none in headless mode
+    new_cpu->cpu_label = NULL;
+    new_cpu->cpu_load  = NULL;
+    if (!headless && cpu_widgets(collection, new_cpu, id, i) < 0) {
         free(new_cpu);
         return NULL;
     }
-    new_cpu->cpu_load = cpu_load;
 
     Cpu* tail = collection->head;
     if (tail) {
@@ -904,30 +797,11 @@ void update_cpu_data(Cpu* cpu, int load) {
 }
 
 // Memory
-MemoryCollection* init_memory() {
-    MemoryCollection* collection = malloc(sizeof(MemoryCollection));
-    if(!collection) {
-      perror("malloc failed");
-      return NULL;
-    }
-    collection->head  = NULL;
-    collection->count = 0;
-
-    struct sysinfo info;
-    if (sysinfo(&info) < 0) {
-        perror("sysinfo");
-        free(collection);
-        return NULL;
-    }
-    uint64_t totalram;
-    totalram = ((uint64_t) info.totalram * info.mem_unit);
-    collection->total = totalram;
-
+static int memory_widgets(MemoryCollection* collection) {
     lv_obj_t* memory_label = lv_label_create(lv_scr_act());
     if (!memory_label) {
-        free(collection);
         perror("lv_label_create allocation failed");
-        return NULL;
+        return -1;
     }
     lv_label_set_text(memory_label, "Memory usage");
     lv_obj_set_size(memory_label, 396, 16);
@@ -936,13 +810,13 @@ MemoryCollection* init_memory() {
     lv_obj_set_style_text_letter_space(memory_label, -1, 0);
     lv_obj_set_style_text_color(memory_label, VX_WHITE_COLOR, 0);
     lv_obj_set_pos(memory_label, 404, 414);
+    collection->memory_label = memory_label;
 
     lv_obj_t* memory_chart = lv_chart_create(lv_scr_act());
     if (!memory_chart) {
         lv_obj_del(memory_label);
-        free(collection);
         perror("lv_chart_create allocation failed");
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(memory_chart, 396, 128);
     lv_obj_align(memory_chart, LV_ALIGN_TOP_RIGHT, 0, 432);
@@ -955,37 +829,60 @@ MemoryCollection* init_memory() {
     lv_obj_set_style_pad_all(memory_chart, 0, 0);
     lv_chart_set_point_count(memory_chart, VX_MEMORY_CHART_SIZE);
     collection->memory_chart = memory_chart;
+    return 0;
+}
+
+MemoryCollection* init_memory() {
+    MemoryCollection* collection = malloc(sizeof(MemoryCollection));
+    if(!collection) {
+      perror("malloc failed");
+      return NULL;
+    }
+    collection->head  = NULL;
+    collection->count = 0;
+
+    struct sysinfo info;
+    if (sysinfo(&info) < 0) {
+        perror("sysinfo");
+        free(collection);
+        return NULL;
+    }
+    uint64_t totalram;
+    totalram = ((uint64_t) info.totalram * info.mem_unit);
+    collection->total = totalram;
+
+    // Widgets, none in headless mode
+    collection->memory_label = NULL;
+    collection->memory_chart = NULL;
+    if (!headless && memory_widgets(collection) < 0) {
+        free(collection);
+        return NULL;
+    }
 
     if (!add_memory(collection, "Main")) {
-        lv_obj_del(memory_chart);
-        lv_obj_del(memory_label);
+        if (collection->memory_chart) {
+            lv_obj_del(collection->memory_chart);
+            lv_obj_del(collection->memory_label);
+        }
         free(collection);
         return NULL;
     }
     if (!add_memory(collection, "Process")) {
-        lv_obj_del(memory_chart);
-        lv_obj_del(memory_label);
+        if (collection->memory_chart) {
+            lv_obj_del(collection->memory_chart);
+            lv_obj_del(collection->memory_label);
+        }
         free(collection);
         return NULL;
     }
     return collection;
 }
 
-Memory* add_memory(MemoryCollection* collection, const char* name) {
-    static int i = 0;
-    Memory* new_memory = malloc(sizeof(Memory));
-    if (!new_memory) {
-        perror("malloc failed");
-        return NULL;
-    }
-    new_memory->parent = collection;
-    strncpy(new_memory->name, name, 32);
-
+static int memory_entry_widgets(MemoryCollection* collection, Memory* new_memory, int i) {
     lv_obj_t* memory_label = lv_label_create(lv_scr_act());
     if (!memory_label) {
         perror("lv_label_create allocation failed");
-        free(new_memory);
-        return NULL;
+        return -1;
     }
     lv_obj_set_size(memory_label, 256, 16);
     lv_obj_set_style_text_align(memory_label, LV_TEXT_ALIGN_LEFT, 0);
@@ -999,10 +896,29 @@ Memory* add_memory(MemoryCollection* collection, const char* name) {
     if (!memory_load) {
         perror("lv_chart_add_series allocation failed");
         lv_obj_del(memory_label);
+        return -1;
+    }
+    new_memory->memory_load = memory_load;
+    return 0;
+}
+
+Memory* add_memory(MemoryCollection* collection, const char* name) {
+    static int i = 0;
+    Memory* new_memory = malloc(sizeof(Memory));
+    if (!new_memory) {
+        perror("malloc failed");
+        return NULL;
+    }
+    new_memory->parent = collection;
+    strncpy(new_memory->name, name, 32);
+
+    // Widgets, none in headless mode
+    new_memory->memory_label = NULL;
+    new_memory->memory_load  = NULL;
+    if (!headless && memory_entry_widgets(collection, new_memory, i) < 0) {
         free(new_memory);
         return NULL;
     }
-    new_memory->memory_load = memory_load;
 
     Memory* tail = collection->head;
     if (tail) {
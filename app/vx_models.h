@@ -13,15 +13,42 @@ typedef struct InterfaceStats {
     uint64_t rx_packets;
     uint64_t rx_dropped_bytes;
     uint64_t rx_dropped;
+    uint64_t rx_truncated_bytes; // Bytes removed by snaplen (VLANs only)
+    uint64_t rx_sampled_out;     // Frames skipped by sampling (VLANs only)
+    uint64_t rx_duplicates;      // Frames removed by dedup (VLANs only)
     uint64_t tx_bytes;
     uint64_t tx_packets;
     uint64_t tx_dropped;
+    uint64_t timestamp;          // Sample time (CLOCK_MONOTONIC ns), shared by every interface of a sample
 } InterfaceStats;
 
+// InterfaceStats counters with a per-second delta history, in stats order
+enum {
+    VX_STAT_RX_BYTES,
+    VX_STAT_RX_PACKETS,
+    VX_STAT_RX_DROPPED_BYTES,
+    VX_STAT_RX_DROPPED,
+    VX_STAT_TX_BYTES,
+    VX_STAT_TX_PACKETS,
+    VX_STAT_TX_DROPPED,
+    VX_HISTORY_FIELDS
+};
+#define VX_STAT_FIELDS 10 // InterfaceStats counters, timestamp excluded
+
 typedef struct InterfaceBuffer {
-    struct InterfaceStats data[VX_NETWORK_CHART_SIZE+1];
+    struct InterfaceStats last; // Latest cumulative counters
+    bool primed;                // last holds a sample
+    // Per-second deltas, one array per counter. Each delta is also written
+    // VX_NETWORK_CHART_SIZE further, so the window is always contiguous:
+    // delta[field][head] .. delta[field][head + count - 1], oldest first
+    uint64_t delta[VX_HISTORY_FIELDS][2 * VX_NETWORK_CHART_SIZE];
     int head;
     int count;
+    // Running sums for the SMA, monotonic deques of positions for the max
+    uint64_t sum[VX_HISTORY_FIELDS];
+    int deque[VX_HISTORY_FIELDS][VX_NETWORK_CHART_SIZE];
+    int deque_head[VX_HISTORY_FIELDS];
+    int deque_count[VX_HISTORY_FIELDS];
 } InterfaceBuffer;
 
 typedef enum {
@@ -45,12 +72,14 @@ typedef struct Vlan {
     struct Vlan*  padding;
     // Identifiers
     struct Interface* parent;
-    struct Interface* redirection;
-    int vlan_id;
+    struct Interface* redirections[VX_MAX_OUTPUT_INTERFACES];
+    int redirection_count;
+    int vlan_id;       // outer tag
+    int inner_vlan_id; // inner tag of an (outer, inner) rule, -1 if none
     // Display
     lv_obj_t* name;
-    lv_obj_t*          line;
-    lv_point_precise_t points[4];
+    lv_obj_t*          lines[VX_MAX_OUTPUT_INTERFACES];
+    lv_point_precise_t points[VX_MAX_OUTPUT_INTERFACES][4];
     bool   is_up;
     // Chart
     lv_obj_t*          network_chart;
@@ -81,15 +110,18 @@ typedef struct Interface {
     struct InterfaceCollection* parent;
     int  if_index;
     char interface_name[IFNAMSIZ];
-    // BPF
+    // BPF (one object shared by every input)
+    int    input_slot; // Block of this input in the per-input maps
     int    vlan_stats_fd;
     int    vlan_redirect_map_fd;
+    int    qinq_stats_fd;
     // Display
     lv_obj_t* name;
     lv_obj_t* image;
     lv_obj_t* status;
     bool      is_up;
     struct bpf_object* bpf_prog;
+    __u32              xdp_flags;
     lv_obj_t*          xdp_mode;
     struct Vlan*  vlan_selected;
     // Chart
@@ -179,7 +211,8 @@ int  Interface_set_focus(Interface* interface, const bool focus, const vx_displa
 void OutputInterface_position(Interface* interface, int i);
 void update_interface_data(Interface* interface, InterfaceStats time_interval_stats);
 
-Vlan* add_or_update_vlan(Interface* interface, int vlan_id);
+Vlan* add_or_update_vlan(Interface* interface, int vlan_id, int inner_vlan_id);
+int  Vlan_add_redirection(Vlan* vlan, Interface* redirection);
 void Vlan_reposition(Vlan* vlan);
 void Vlan_refresh(Vlan* vlan);
 void Vlan_visible(Vlan* vlan, const bool state);
@@ -187,7 +220,6 @@ int  Vlan_set_focus(Vlan* vlan, const bool focus, const vx_display_mode mode);
 void update_vlan_data(Vlan* vlan, InterfaceStats time_interval_stats);
 
 int  init_circular_buffer(InterfaceBuffer* buffer);
-void add_data_to_buffer(InterfaceBuffer* buffer, InterfaceStats time_interval_stats);
 
 // Cpu
 CpuCollection* init_cpus();
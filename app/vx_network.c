@@ -17,8 +17,14 @@
 #include <net/if.h>
 #include <linux/ethtool.h>
 #include <linux/sockios.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 
 struct nl_sock *sock;
+// Link cache kept up to date by RTNLGRP_LINK notifications, link state is
+// read from memory instead of dumping every link of the system
+static struct nl_cache_mngr *link_mngr = NULL;
+static struct nl_cache      *link_cache = NULL;
 
 int rtnl_initialize() {
     sock = nl_socket_alloc();
@@ -31,28 +37,52 @@ int rtnl_initialize() {
         nl_socket_free(sock);
         return -1;
     }
+    // The manager allocates its own notification socket
+    if (nl_cache_mngr_alloc(NULL, NETLINK_ROUTE, NL_AUTO_PROVIDE, &link_mngr) < 0) {
+        perror("Error allocating netlink cache manager");
+        nl_close(sock);
+        nl_socket_free(sock);
+        return -1;
+    }
+    if (nl_cache_mngr_add(link_mngr, "route/link", NULL, NULL, &link_cache) < 0) {
+        perror("Error adding link cache to the netlink cache manager");
+        nl_cache_mngr_free(link_mngr);
+        link_mngr = NULL;
+        nl_close(sock);
+        nl_socket_free(sock);
+        return -1;
+    }
     return 0;
 }
 
 void rtnl_cleanup() {
+    if (link_mngr)
+        nl_cache_mngr_free(link_mngr);
+    link_mngr = NULL;
     if (sock)
         nl_close(sock);
     if (sock)
         nl_socket_free(sock);
 }
 
+// Apply the pending link notifications without blocking
+int rtnl_update() {
+    if (!link_mngr)
+        return 0;
+    int ret = nl_cache_mngr_data_ready(link_mngr);
+    if (ret < 0) {
+        fprintf(stderr, "Error processing link notifications: %s\n", nl_geterror(ret));
+        return -1;
+    }
+    return ret;
+}
+
 int interface_set_flag(const int if_index, const unsigned int flag) {
 	struct rtnl_link* link;
 	struct rtnl_link* change;
-	struct nl_cache* cache;
-	if (rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache) < 0) {
-		perror("Error allocating netlink cache");
-		return -1;
-	}
-	link = rtnl_link_get(cache, if_index);
+	link = rtnl_link_get(link_cache, if_index);
 	if (!link) {
 		perror("Error allocating netlink link");
-		nl_cache_free(cache);
 		return -1;
 	}
 	change = rtnl_link_alloc();
@@ -61,12 +91,10 @@ int interface_set_flag(const int if_index, const unsigned int flag) {
 		perror("Can't change flags");
 		rtnl_link_put(link);
 		rtnl_link_put(change);
-		nl_cache_free(cache);
 		return -1;
 	}
 	rtnl_link_put(link);
 	rtnl_link_put(change);
-	nl_cache_free(cache);
 	return 0;
 }
 int interface_set_up(const char* interface_name) {
@@ -82,20 +110,13 @@ int interface_set_promisc(const char* interface_name) {
 
 unsigned int interface_get_flags(const int if_index) {
 	struct rtnl_link *link;
-	struct nl_cache* cache;
-	if (rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache) < 0) {
-		perror("Error allocating netlink cache");
-		return -1;
-	}
-	link = rtnl_link_get(cache, if_index);
+	link = rtnl_link_get(link_cache, if_index);
 	if (!link) {
 		perror("Error allocating netlink link");
-		nl_cache_free(cache);
-		return -1;
+		return 0;
 	}
 	unsigned int flags = rtnl_link_get_flags(link);
 	rtnl_link_put(link);
-	nl_cache_free(cache);
 	return flags;
 }
 bool interface_is_up(const int if_index) {
@@ -107,26 +128,142 @@ bool interface_is_promisc(const int if_index) {
 	return (flags & IFF_PROMISC);
 }
 
-int interface_disable_rxvlan(const char* ifname) {
-	char cmdline[64];
-	if(sprintf(cmdline, "/bin/ethtool -K %.16s rx-vlan-offload off", ifname) < 0) {
-		perror("cmdline sprintf");
+static int interface_ioctl(const char* ifname, unsigned long request, struct ifreq* ifr) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
 		return -1;
 	}
-	printf("%s\n", cmdline);
-	int ret = system(cmdline);
+	memset(ifr, 0, sizeof(*ifr));
+	strncpy(ifr->ifr_name, ifname, IFNAMSIZ - 1);
+	int ret = ioctl(fd, request, ifr);
+	close(fd);
 	return ret;
 }
-int interface_disable_txvlan(const char* ifname) {
-	char cmdline[64];
-	if(sprintf(cmdline, "/bin/ethtool -K %.16s tx-vlan-offload off", ifname) < 0) {
-		perror("cmdline sprintf");
+int interface_get_mac(const char* ifname, unsigned char mac[6]) {
+	struct ifreq ifr;
+	if (interface_ioctl(ifname, SIOCGIFHWADDR, &ifr) < 0) {
+		perror("SIOCGIFHWADDR");
+		return -1;
+	}
+	memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+	return 0;
+}
+int interface_get_ipv4(const char* ifname, __be32* address) {
+	struct ifreq ifr;
+	if (interface_ioctl(ifname, SIOCGIFADDR, &ifr) < 0) {
+		perror("SIOCGIFADDR");
+		return -1;
+	}
+	*address = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr.s_addr;
+	return 0;
+}
+
+static int interface_ethtool(const char* ifname, void* command) {
+	struct ifreq ifr;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	ifr.ifr_data = command;
+	int ret = ioctl(fd, SIOCETHTOOL, &ifr);
+	close(fd);
+	return ret;
+}
+
+// Index of a netdev feature name ("rx-vlan-hw-parse", ...) in the
+// ETH_SS_FEATURES string set of the interface, -1 if the driver lacks it
+static int interface_feature_index(const char* ifname, const char* feature, __u32* count) {
+	struct {
+		struct ethtool_sset_info info;
+		__u32 data[1];
+	} sset = {.info = {.cmd = ETHTOOL_GSSET_INFO, .sset_mask = 1ULL << ETH_SS_FEATURES}};
+	if (interface_ethtool(ifname, &sset) < 0 || !sset.info.sset_mask) {
+		perror("ETHTOOL_GSSET_INFO");
+		return -1;
+	}
+	*count = sset.data[0];
+
+	struct ethtool_gstrings* strings = calloc(1, sizeof(*strings) + *count * ETH_GSTRING_LEN);
+	if (!strings) {
+		perror("calloc failed");
+		return -1;
+	}
+	strings->cmd = ETHTOOL_GSTRINGS;
+	strings->string_set = ETH_SS_FEATURES;
+	strings->len = *count;
+	if (interface_ethtool(ifname, strings) < 0) {
+		perror("ETHTOOL_GSTRINGS");
+		free(strings);
+		return -1;
+	}
+	int index = -1;
+	for (__u32 i = 0; i < strings->len; i++) {
+		if (strncmp((char*)strings->data + i * ETH_GSTRING_LEN, feature, ETH_GSTRING_LEN) == 0) {
+			index = i;
+			break;
+		}
+	}
+	free(strings);
+	return index;
+}
+
+// Turn a netdev feature off with SIOCETHTOOL (same as "ethtool -K <ifname>
+// <feature> off") and check the driver really dropped it
+static int interface_disable_feature(const char* ifname, const char* feature) {
+	__u32 count;
+	int index = interface_feature_index(ifname, feature, &count);
+	if (index < 0) {
+		fprintf(stderr, "Warning: %s has no %s feature\n", ifname, feature);
+		return 0;
+	}
+	__u32 blocks = (count + 31) / 32;
+	__u32 block = index / 32;
+	__u32 bit = 1U << (index % 32);
+
+	struct ethtool_sfeatures* set = calloc(1, sizeof(*set) + blocks * sizeof(set->features[0]));
+	struct ethtool_gfeatures* get = calloc(1, sizeof(*get) + blocks * sizeof(get->features[0]));
+	if (!set || !get) {
+		perror("calloc failed");
+		free(set);
+		free(get);
 		return -1;
 	}
-	printf("%s\n", cmdline);
-	int ret = system(cmdline);
+	set->cmd = ETHTOOL_SFEATURES;
+	set->size = blocks;
+	set->features[block].valid = bit;
+	set->features[block].requested = 0;
+	get->cmd = ETHTOOL_GFEATURES;
+	get->size = blocks;
+
+	int ret = 0;
+	if (interface_ethtool(ifname, set) < 0) {
+		perror("ETHTOOL_SFEATURES");
+		ret = -1;
+	} else if (interface_ethtool(ifname, get) < 0) {
+		perror("ETHTOOL_GFEATURES");
+		ret = -1;
+	} else if (get->features[block].active & bit) {
+		fprintf(stderr, "Error: %s is still enabled on %s\n", feature, ifname);
+		ret = -1;
+	} else {
+		printf("%s: %s off\n", ifname, feature);
+	}
+	free(set);
+	free(get);
 	return ret;
 }
+
+// ethtool "rx-vlan-offload" and "tx-vlan-offload"
+int interface_disable_rxvlan(const char* ifname) {
+	return interface_disable_feature(ifname, "rx-vlan-hw-parse");
+}
+int interface_disable_txvlan(const char* ifname) {
+	return interface_disable_feature(ifname, "tx-vlan-hw-insert");
+}
 int prepare_input_interface(const char* ifname) {
 	if (interface_disable_rxvlan(ifname) < 0) {
 		perror("interface_disable_rxvlan");
@@ -1,12 +1,19 @@
 #ifndef VX_NETWORK
 #define VX_NETWORK
 
+#include <stdbool.h>
+#include <linux/types.h>
+
 int  rtnl_initialize();
 void rtnl_cleanup();
+int  rtnl_update();
 
 bool interface_is_up(const int if_index);
 bool interface_is_promisc(const int if_index);
 
+int interface_get_mac(const char* ifname, unsigned char mac[6]);
+int interface_get_ipv4(const char* ifname, __be32* address);
+
 int prepare_input_interface(const char* ifname);
 int prepare_output_interface(const char* ifname);
 
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include "vx_config.h"
+#include "vx_sampler.h"
+
+// Counters are read by a dedicated thread on its own timer and published
+// through a single-producer single-consumer ring: the sampler only moves
+// head, the UI only moves tail, no lock is shared with the render loop
+static Sample* ring = NULL;
+static size_t ring_head __attribute__((aligned(64))) = 0; // Next sample written
+static size_t ring_tail __attribute__((aligned(64))) = 0; // Next sample read
+static size_t overruns = 0;
+
+static long period_ms = VX_SAMPLE_PERIOD;
+static int  timer_fd = -1;
+static pthread_t sampler_thread;
+static bool running = false;
+static bool failed  = false;
+
+static CpuCollection*    cpu_collection    = NULL;
+static MemoryCollection* memory_collection = NULL;
+
+int sampler_set_period(long period) {
+    if (period < VX_SAMPLE_PERIOD_MIN || period > VX_SAMPLE_PERIOD_MAX) {
+        fprintf(stderr, "Error: sample_period_ms must be between %d and %d\n", VX_SAMPLE_PERIOD_MIN, VX_SAMPLE_PERIOD_MAX);
+        return -1;
+    }
+    period_ms = period;
+    return 0;
+}
+
+static void* sampler_run(void* arg) {
+    uint64_t exp;
+
+    while (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        if (read(timer_fd, &exp, sizeof(exp)) != sizeof(exp)) {
+            perror("sampler: timerfd read");
+            break;
+        }
+        size_t head = ring_head;
+        // The UI is behind: skip this period, counters are cumulative
+        if (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) == VX_SAMPLE_RING) {
+            overruns++;
+            continue;
+        }
+        Sample* sample = &ring[head % VX_SAMPLE_RING];
+        if (collect_interfaces_data(sample) < 0
+            || collect_cpus_data(cpu_collection, sample) < 0
+            || collect_memory_data(memory_collection, sample) < 0)
+            break;
+        __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&failed, __atomic_load_n(&running, __ATOMIC_RELAXED), __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int sampler_start(InterfaceCollection* interfaces, CpuCollection* cpus, MemoryCollection* memory) {
+    struct itimerspec new_value = {
+        .it_value    = {.tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000L},
+        .it_interval = {.tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000L},
+    };
+
+    ring = calloc(VX_SAMPLE_RING, sizeof(Sample));
+    if (!ring) {
+        perror("Error: sample ring allocation failed");
+        return -1;
+    }
+    if (collect_init(interfaces) < 0) {
+        free(ring);
+        ring = NULL;
+        return -1;
+    }
+    for (int i = 0; i < VX_SAMPLE_RING; i++)
+        if (sample_alloc(&ring[i]) < 0) {
+            sampler_stop();
+            return -1;
+        }
+    cpu_collection = cpus;
+    memory_collection = memory;
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (timer_fd == -1) {
+        perror("sampler: timerfd_create");
+        sampler_stop();
+        return -1;
+    }
+    if (timerfd_settime(timer_fd, 0, &new_value, NULL) == -1) {
+        perror("sampler: timerfd_settime");
+        sampler_stop();
+        return -1;
+    }
+
+    running = true;
+    if (pthread_create(&sampler_thread, NULL, sampler_run, NULL) != 0) {
+        perror("sampler: pthread_create");
+        running = false;
+        sampler_stop();
+        return -1;
+    }
+    printf("Sampling every %ld ms\n", period_ms);
+    return 0;
+}
+
+// Drain every published sample, keeping a copy of the newest one in latest
+// (from sample_alloc). Returns the number of samples drained, -1 if the sampler stopped
+int sampler_consume(Sample* latest) {
+    if (__atomic_load_n(&failed, __ATOMIC_ACQUIRE))
+        return -1;
+    if (!ring)
+        return 0;
+    size_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    size_t tail = ring_tail;
+    if (head == tail)
+        return 0;
+    sample_copy(latest, &ring[(head - 1) % VX_SAMPLE_RING]);
+    __atomic_store_n(&ring_tail, head, __ATOMIC_RELEASE);
+    return (int)(head - tail);
+}
+
+void sampler_stop() {
+    if (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&running, false, __ATOMIC_RELAXED);
+        pthread_join(sampler_thread, NULL);
+    }
+    if (timer_fd != -1)
+        close(timer_fd);
+    timer_fd = -1;
+    collect_cleanup();
+    if (ring)
+        for (int i = 0; i < VX_SAMPLE_RING; i++)
+            sample_free(&ring[i]);
+    free(ring);
+    ring = NULL;
+    if (overruns)
+        printf("Sampler skipped %zu periods\n", overruns);
+}
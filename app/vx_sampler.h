@@ -0,0 +1,12 @@
+#ifndef VX_SAMPLER
+#define VX_SAMPLER
+
+#include "vx_models.h"
+#include "vx_stats.h"
+
+int  sampler_set_period(long period);
+int  sampler_start(InterfaceCollection* interfaces, CpuCollection* cpus, MemoryCollection* memory);
+int  sampler_consume(Sample* latest);
+void sampler_stop();
+
+#endif
@@ -2,12 +2,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <linux/types.h>
 #include <net/if.h>
 #include <netlink/netlink.h>
-#include <netlink/route/link.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/handlers.h>
+#include <netlink/route/rtnl.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <time.h>
 #include <sys/sysinfo.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
 #include <netlink/cache.h>
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
@@ -18,125 +26,377 @@
 #include "vx_network.h"
 
 // Interfaces
-extern struct nl_sock *sock;
+// The sampler thread owns its netlink socket, the interfaces it reads are
+// snapshotted by collect_init() once the configuration is loaded
+static struct nl_sock* stats_sock = NULL;
+static int input_ifindex[VX_MAX_INPUT_INTERFACES];   // By input slot, 0 if unused
+static int output_ifindex[VX_MAX_OUTPUT_INTERFACES]; // By output position
+static int output_count = 0;
 
-int collect_interface_data(const int if_index, InterfaceStats* interface_stats) {
-    struct rtnl_link* link;
-    if (rtnl_link_get_kernel(sock, if_index, NULL, &link) < 0) {
-        perror("collect_interface_data: Netlink get object from kernel failed");
+// (outer, inner) rules, their counters are read from qinq_stats
+struct qinq_rule {
+    int fd;
+    int slot;
+    int vlan_id;
+    int inner_vlan_id;
+};
+static struct qinq_rule* qinq_rules = NULL;
+static int qinq_rule_count = 0;
+// VLANs a sample can carry: every key of every input, then the pairs
+static int sample_vlans = 0;
+
+// Counters of every link come from a single RTM_GETLINK dump per sample,
+// IFLA_STATS64 is parsed in place into the sample
+static struct nl_cb* link_dump_cb = NULL;
+
+static InterfaceStats* find_link(Sample* sample, int if_index) {
+    for (int slot = 0; slot < VX_MAX_INPUT_INTERFACES; slot++)
+        if (input_ifindex[slot] == if_index)
+            return &sample->inputs[slot];
+    for (int i = 0; i < output_count; i++)
+        if (output_ifindex[i] == if_index)
+            return &sample->outputs[i];
+    return NULL;
+}
+
+static int parse_link_stats(struct nl_msg* msg, void* arg) {
+    Sample* sample = arg;
+    struct nlmsghdr* nlh = nlmsg_hdr(msg);
+    struct rtnl_link_stats64 stats;
+
+    if (nlh->nlmsg_type != RTM_NEWLINK || !nlmsg_valid_hdr(nlh, sizeof(struct ifinfomsg)))
+        return NL_OK;
+    struct ifinfomsg* ifi = nlmsg_data(nlh);
+    InterfaceStats* interface_stats = find_link(sample, ifi->ifi_index);
+    if (!interface_stats)
+        return NL_OK;
+    struct nlattr* attr = nlmsg_find_attr(nlh, sizeof(*ifi), IFLA_STATS64);
+    if (!attr || nla_len(attr) < (int)sizeof(stats))
+        return NL_OK;
+    // Attributes are only 4 bytes aligned
+    memcpy(&stats, nla_data(attr), sizeof(stats));
+
+    interface_stats->rx_bytes   = stats.rx_bytes;
+    interface_stats->rx_packets = stats.rx_packets;
+    interface_stats->rx_dropped = stats.rx_dropped;
+    interface_stats->tx_bytes   = stats.tx_bytes;
+    interface_stats->tx_packets = stats.tx_packets;
+    interface_stats->tx_dropped = stats.tx_dropped;
+    return NL_OK;
+}
+
+static int collect_links_data(Sample* sample) {
+    int ret;
+
+    nl_cb_set(link_dump_cb, NL_CB_VALID, NL_CB_CUSTOM, parse_link_stats, sample);
+    if ((ret = nl_rtgen_request(stats_sock, RTM_GETLINK, AF_UNSPEC, NLM_F_DUMP)) < 0
+        || (ret = nl_recvmsgs(stats_sock, link_dump_cb)) < 0) {
+        fprintf(stderr, "collect_links_data: RTM_GETLINK dump failed: %s\n", nl_geterror(ret));
         return -1;
     }
-    interface_stats->rx_bytes   =  rtnl_link_get_stat(link, RTNL_LINK_RX_BYTES);
-    interface_stats->rx_packets =  rtnl_link_get_stat(link, RTNL_LINK_RX_PACKETS);
-    interface_stats->rx_dropped =  rtnl_link_get_stat(link, RTNL_LINK_RX_DROPPED);
-    interface_stats->tx_bytes   =  rtnl_link_get_stat(link, RTNL_LINK_TX_BYTES);
-    interface_stats->tx_packets =  rtnl_link_get_stat(link, RTNL_LINK_TX_PACKETS);
-    interface_stats->tx_dropped =  rtnl_link_get_stat(link, RTNL_LINK_TX_DROPPED);
-    rtnl_link_put(link);
     return 0;
 }
 
-int collect_interfaces_data(InterfaceCollection* collection) {
-    Interface* interface = collection->input_head;
+int collect_init(InterfaceCollection* collection) {
+    Interface* interface;
+    int count = 0;
+
+    stats_sock = nl_socket_alloc();
+    if (!stats_sock) {
+        perror("Error allocating netlink socket");
+        return -1;
+    }
+    if (nl_connect(stats_sock, NETLINK_ROUTE) != 0) {
+        perror("Error connecting to netlink socket");
+        collect_cleanup();
+        return -1;
+    }
+    link_dump_cb = nl_cb_alloc(NL_CB_DEFAULT);
+    if (!link_dump_cb) {
+        perror("nl_cb_alloc failed");
+        collect_cleanup();
+        return -1;
+    }
 
-    bool vlans[4096];
-    memset(vlans, false, 4096);
+    memset(input_ifindex, 0, sizeof(input_ifindex));
+    for (interface = collection->input_head; interface; interface = interface->next) {
+        input_ifindex[interface->input_slot] = interface->if_index;
+        for (Vlan* vlan = interface->vlan_stats; vlan; vlan = vlan->next)
+            if (vlan->inner_vlan_id >= 0)
+                count++;
+    }
+    output_count = 0;
+    for (interface = collection->output_head; interface; interface = interface->next)
+        output_ifindex[output_count++] = interface->if_index;
 
-    while (interface) {
-        // printf("[%s]", ((lv_label_t*)interface->name)->text);
-        InterfaceStats interface_stats;
-        if (collect_interface_data(interface->if_index, &interface_stats))
+    // (outer, inner) rules only come from the configuration
+    if (count) {
+        qinq_rules = malloc(count * sizeof(struct qinq_rule));
+        if (!qinq_rules) {
+            perror("malloc failed");
+            collect_cleanup();
             return -1;
-        update_interface_data(interface, interface_stats);
-
-        int map_fd = interface->vlan_stats_fd;
-        long long key = 0, prev_key = -1;
-        // Collect from BPF map VLAN list
-        if (interface->type == VX_CLASS_INPUT_INTERFACE) {
-            while(bpf_map_get_next_key(map_fd, &prev_key, &key) == 0) {
-                int vlan_id = key;
-                // printf(" %d", vlan_id);
-                struct vlan_stats value;
-                if (bpf_map_lookup_elem(map_fd, &key, &value) < 0) {
-                    perror("collect_interfaces_data: bpf_map_lookup_elem");
-                    return -1;
-                }
-                InterfaceStats interface_stats = {
-                    .rx_bytes         = value.bytes,
-                    .rx_packets       = value.packets,
-                    .rx_dropped_bytes = value.dropped_bytes,
-                    .rx_dropped       = value.dropped
+        }
+    }
+    qinq_rule_count = 0;
+    for (interface = collection->input_head; interface; interface = interface->next)
+        for (Vlan* vlan = interface->vlan_stats; vlan; vlan = vlan->next)
+            if (vlan->inner_vlan_id >= 0)
+                qinq_rules[qinq_rule_count++] = (struct qinq_rule){
+                    .fd = interface->qinq_stats_fd,
+                    .slot = interface->input_slot,
+                    .vlan_id = vlan->vlan_id,
+                    .inner_vlan_id = vlan->inner_vlan_id,
                 };
-                Vlan* vlan = add_or_update_vlan(interface, vlan_id);
-                if (!vlan)
-                    return -1;
-                update_vlan_data(vlan, interface_stats);
-                vlans[vlan_id] = true;
-                prev_key=key;
-            }
-            // Fill stats for configured VLANs with no data in BPF map
-            Vlan* vlan = interface->vlan_stats;
-            InterfaceStats zeros = {.rx_bytes = 0, .rx_packets = 0, .rx_dropped = 0, .rx_dropped_bytes = 0};
-            while (vlan) {
-                if (!vlans[vlan->vlan_id]) {
-                    if (vlan->buffer.count > 0) {
-                        update_vlan_data(vlan, vlan->buffer.data[(vlan->buffer.head + VX_NETWORK_CHART_SIZE) % (VX_NETWORK_CHART_SIZE + 1)]);
-                    } else {
-                        update_vlan_data(vlan, zeros);
-                    }
-                }
-                vlan = vlan->next;
-            }
+    sample_vlans = collection->input_count * VX_VLAN_COUNT + qinq_rule_count;
+    return 0;
+}
+
+// The VLAN array is sized for the worst case but only the active VLANs are
+// written: the untouched pages of the allocation are never backed
+int sample_alloc(Sample* sample) {
+    sample->vlan_count = 0;
+    sample->vlan_capacity = sample_vlans;
+    sample->vlans = calloc(sample_vlans ? sample_vlans : 1, sizeof(VlanSample));
+    if (!sample->vlans) {
+        perror("Error: sample allocation failed");
+        return -1;
+    }
+    return 0;
+}
+
+void sample_free(Sample* sample) {
+    free(sample->vlans);
+    sample->vlans = NULL;
+    sample->vlan_count = sample->vlan_capacity = 0;
+}
+
+// Both samples come from sample_alloc(), only the active VLANs are copied
+void sample_copy(Sample* dst, const Sample* src) {
+    VlanSample* vlans = dst->vlans;
+    int capacity = dst->vlan_capacity;
+
+    memcpy(dst, src, sizeof(Sample));
+    dst->vlans = vlans;
+    dst->vlan_capacity = capacity;
+    dst->vlan_count = src->vlan_count < capacity ? src->vlan_count : capacity;
+    memcpy(dst->vlans, src->vlans, dst->vlan_count * sizeof(VlanSample));
+}
+
+void collect_cleanup() {
+    if (link_dump_cb)
+        nl_cb_put(link_dump_cb);
+    link_dump_cb = NULL;
+    if (stats_sock) {
+        nl_close(stats_sock);
+        nl_socket_free(stats_sock);
+    }
+    stats_sock = NULL;
+    free(qinq_rules);
+    qinq_rules = NULL;
+    qinq_rule_count = 0;
+}
+
+// VLAN statistics of every input are one mmapable array: the per-CPU slots
+// of the input slot * VX_VLAN_COUNT + VLAN ID key follow each other and are
+// read with plain loads, without syscalls
+static int vlan_stats_cpus = 0;
+static __u32 vlan_stats_entries = 0;
+static const struct vlan_counters* vlan_counters = NULL;
+static struct vlan_stats* qinq_stats_values = NULL;
+
+// Map the array once, shared by every input
+int vlan_stats_mmap(int vlan_stats_fd) {
+    struct bpf_map_info info;
+    __u32 info_len = sizeof(info);
+
+    if (vlan_counters)
+        return 0;
+    vlan_stats_cpus = libbpf_num_possible_cpus();
+    if (vlan_stats_cpus < 1) {
+        perror("libbpf_num_possible_cpus");
+        return -1;
+    }
+    memset(&info, 0, sizeof(info));
+    if (bpf_obj_get_info_by_fd(vlan_stats_fd, &info, &info_len) < 0) {
+        perror("vlan_stats_mmap: bpf_obj_get_info_by_fd");
+        return -1;
+    }
+    qinq_stats_values = malloc(vlan_stats_cpus * sizeof(struct vlan_stats));
+    if (!qinq_stats_values) {
+        perror("malloc failed");
+        return -1;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t size = (size_t)info.max_entries * sizeof(struct vlan_counters);
+    size = (size + page_size - 1) & ~(page_size - 1);
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, vlan_stats_fd, 0);
+    if (map == MAP_FAILED) {
+        perror("vlan_stats_mmap: mmap");
+        free(qinq_stats_values);
+        qinq_stats_values = NULL;
+        return -1;
+    }
+    vlan_counters = map;
+    vlan_stats_entries = info.max_entries / vlan_stats_cpus;
+    return 0;
+}
+
+static void sum_vlan_stats(const void* percpu, size_t stride, InterfaceStats* interface_stats) {
+    memset(interface_stats, 0, sizeof(*interface_stats));
+    for (int cpu = 0; cpu < vlan_stats_cpus; cpu++) {
+        const struct vlan_stats* stats = (const void*)((const char*)percpu + cpu * stride);
+        interface_stats->rx_bytes         += stats->bytes;
+        interface_stats->rx_packets       += stats->packets;
+        interface_stats->rx_dropped_bytes += stats->dropped_bytes;
+        interface_stats->rx_dropped       += stats->dropped;
+        interface_stats->rx_truncated_bytes += stats->truncated_bytes;
+        interface_stats->rx_sampled_out     += stats->sampled_out;
+        interface_stats->rx_duplicates      += stats->duplicates;
+    }
+}
+
+static int collect_vlans_data(Sample* sample) {
+    VlanSample* vlan_sample;
+
+    sample->vlan_count = 0;
+    if (!vlan_counters)
+        return 0;
+
+    // Room for every key and pair, nothing is left out
+    if (sample->vlan_capacity < qinq_rule_count + (int)vlan_stats_entries) {
+        fprintf(stderr, "collect_vlans_data: sample holds %d VLANs, %d expected\n",
+                sample->vlan_capacity, qinq_rule_count + (int)vlan_stats_entries);
+        return -1;
+    }
+
+    // Configured (outer, inner) pairs first
+    for (int i = 0; i < qinq_rule_count; i++) {
+        __u32 key = VX_QINQ_KEY(qinq_rules[i].slot, qinq_rules[i].vlan_id, qinq_rules[i].inner_vlan_id);
+        if (bpf_map_lookup_elem(qinq_rules[i].fd, &key, qinq_stats_values) < 0) {
+            perror("collect_vlans_data: bpf_map_lookup_elem");
+            return -1;
         }
-        // puts("");
-        interface = interface->next;
+        vlan_sample = &sample->vlans[sample->vlan_count++];
+        vlan_sample->slot = qinq_rules[i].slot;
+        vlan_sample->vlan_id = qinq_rules[i].vlan_id;
+        vlan_sample->inner_vlan_id = qinq_rules[i].inner_vlan_id;
+        sum_vlan_stats(qinq_stats_values, sizeof(struct vlan_stats), &vlan_sample->stats);
+        vlan_sample->stats.timestamp = sample->timestamp;
     }
 
-    interface = collection->output_head;
-    while (interface) {
+    for (__u32 key = 0; key < vlan_stats_entries; key++) {
+        int slot = key / VX_VLAN_COUNT;
         InterfaceStats interface_stats;
-        if (collect_interface_data(interface->if_index, &interface_stats))
+        if (slot >= VX_MAX_INPUT_INTERFACES || !input_ifindex[slot])
+            continue;
+        sum_vlan_stats(&vlan_counters[key * vlan_stats_cpus], sizeof(struct vlan_counters), &interface_stats);
+        // Array slots always exist: only report VLANs that have seen traffic
+        if (!interface_stats.rx_packets && !interface_stats.rx_dropped && !interface_stats.rx_sampled_out
+            && !interface_stats.rx_duplicates)
+            continue;
+        vlan_sample = &sample->vlans[sample->vlan_count++];
+        vlan_sample->slot = slot;
+        vlan_sample->vlan_id = key % VX_VLAN_COUNT;
+        vlan_sample->inner_vlan_id = -1;
+        vlan_sample->stats = interface_stats;
+        vlan_sample->stats.timestamp = sample->timestamp;
+    }
+    return 0;
+}
+
+int collect_interfaces_data(Sample* sample) {
+    // One timestamp for the whole sample
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+        perror("clock_gettime");
+        return -1;
+    }
+    sample->timestamp = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    memset(sample->inputs, 0, sizeof(sample->inputs));
+    memset(sample->outputs, 0, sizeof(sample->outputs));
+
+    if (collect_links_data(sample) < 0)
+        return -1;
+    for (int slot = 0; slot < VX_MAX_INPUT_INTERFACES; slot++)
+        sample->inputs[slot].timestamp = sample->timestamp;
+    for (int i = 0; i < output_count; i++)
+        sample->outputs[i].timestamp = sample->timestamp;
+    if (collect_vlans_data(sample) < 0)
+        return -1;
+    return 0;
+}
+
+int apply_interfaces_sample(InterfaceCollection* collection, const Sample* sample) {
+    static bool vlans[VX_MAX_INPUT_INTERFACES][VX_VLAN_COUNT];
+    Interface* inputs[VX_MAX_INPUT_INTERFACES] = {NULL};
+    Interface* interface;
+    int i = 0;
+
+    for (interface = collection->input_head; interface; interface = interface->next) {
+        inputs[interface->input_slot] = interface;
+        update_interface_data(interface, sample->inputs[interface->input_slot]);
+    }
+    for (interface = collection->output_head; interface; interface = interface->next)
+        update_interface_data(interface, sample->outputs[i++]);
+
+    memset(vlans, false, sizeof(vlans));
+    for (i = 0; i < sample->vlan_count; i++) {
+        const VlanSample* vlan_sample = &sample->vlans[i];
+        if (!inputs[vlan_sample->slot])
+            continue;
+        Vlan* vlan = add_or_update_vlan(inputs[vlan_sample->slot], vlan_sample->vlan_id, vlan_sample->inner_vlan_id);
+        if (!vlan)
             return -1;
-        update_interface_data(interface, interface_stats);
-        interface = interface->next;
+        update_vlan_data(vlan, vlan_sample->stats);
+        if (vlan_sample->inner_vlan_id < 0)
+            vlans[vlan_sample->slot][vlan_sample->vlan_id] = true;
     }
+
+    // Fill stats for configured VLANs with no traffic yet
+    InterfaceStats zeros = {.rx_bytes = 0, .rx_packets = 0, .rx_dropped = 0, .rx_dropped_bytes = 0, .rx_truncated_bytes = 0, .rx_sampled_out = 0, .rx_duplicates = 0, .timestamp = sample->timestamp};
+    for (interface = collection->input_head; interface; interface = interface->next)
+        for (Vlan* vlan = interface->vlan_stats; vlan; vlan = vlan->next)
+            if (vlan->inner_vlan_id < 0 && !vlans[interface->input_slot][vlan->vlan_id])
+                update_vlan_data(vlan, zeros);
     return 0;
 }
 
 // CPUs
-int collect_cpus_data(CpuCollection* collection) {
+int collect_cpus_data(CpuCollection* collection, Sample* sample) {
     FILE* file = fopen("/proc/stat", "r");
     if (file == NULL) {
         perror("Error opening file");
         return -1;
     }
 
-    Cpu* cpu = collection->head;
     char buffer[256];
     int cpu_index, i = 0;
     unsigned long user, nice, system, idle, iowait, irq, softirq, total, busy;
-    while (fgets(buffer, sizeof(buffer), file) && cpu) {
+    sample->cpu_count = 0;
+    while (fgets(buffer, sizeof(buffer), file) && sample->cpu_count < collection->count && sample->cpu_count < VX_MAX_CPUS) {
         if (sscanf(buffer, "cpu%d %lu %lu %lu %lu %lu %lu %lu", &cpu_index, &user, &nice, &system, &idle, &iowait, &irq, &softirq) == 8) {
             if (!i++)
                 continue;
             total = user + nice + system + idle + iowait + irq + softirq;
             busy = total - idle;
             // printf("-stat: cpu%d : %f %%\n", cpu_index, (double)busy/total*100.0);
-            update_cpu_data(cpu, (int)((double)busy / total * 100.0));
-            cpu = cpu->next;
+            sample->cpu_load[sample->cpu_count++] = (int)((double)busy / total * 100.0);
         }
     }
     fclose(file);
     return 0;
 }
 
+void apply_cpus_sample(CpuCollection* collection, const Sample* sample) {
+    int i = 0;
+    for (Cpu* cpu = collection->head; cpu && i < sample->cpu_count; cpu = cpu->next)
+        update_cpu_data(cpu, sample->cpu_load[i++]);
+}
+
 // Memory
-int collect_memory_data(MemoryCollection* collection) {
-    Memory* memory = collection->head;
-    if (!memory) {
-        perror("'Main' Memory not initialized");
-        return -1;
-    }
+int collect_memory_data(MemoryCollection* collection, Sample* sample) {
     // Main
     struct sysinfo info;
     if (sysinfo(&info) < 0) {
@@ -145,16 +405,21 @@ int collect_memory_data(MemoryCollection* collection) {
     }
     uint64_t freeram;
     freeram  = ((uint64_t) info.freeram * info.mem_unit);
-    update_memory_data(memory, (collection->total - freeram));
+    sample->memory_used = collection->total - freeram;
 
-    if (!memory->next) {
-        perror("'Self' Memory not initialized");
-        return -1;
-    }
     // Self
     struct rusage r_usage;
     getrusage(RUSAGE_SELF,&r_usage);
-    update_memory_data(memory->next, r_usage.ru_maxrss*1024);
+    sample->memory_self = r_usage.ru_maxrss*1024;
 
     return 0;
 }
+
+void apply_memory_sample(MemoryCollection* collection, const Sample* sample) {
+    Memory* memory = collection->head;
+    if (!memory)
+        return;
+    update_memory_data(memory, sample->memory_used);
+    if (memory->next)
+        update_memory_data(memory->next, sample->memory_self);
+}
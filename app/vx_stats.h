@@ -4,16 +4,62 @@
 #include <linux/types.h>
 #include "vx_models.h"
 
-// XDP struct
+// XDP struct (vlan_stats counters, qinq_stats per-CPU value)
 struct vlan_stats {
     __u64 bytes;
     __u64 packets;
     __u64 dropped_bytes;
     __u64 dropped;
+    __u64 truncated_bytes;
+    __u64 sampled_out;
+    __u64 duplicates;
 };
 
-int collect_interfaces_data(InterfaceCollection* collection);
-int collect_cpus_data(CpuCollection* collection);
-int collect_memory_data(MemoryCollection* collection);
+// XDP struct (vlan_stats value), one 64 bytes slot per CPU for each
+// input slot * VX_VLAN_COUNT + VLAN ID key
+struct vlan_counters {
+    struct vlan_stats stats;
+    __u64 padding;
+};
+
+// Counters of a VLAN, or (outer, inner) pair, of one input
+typedef struct VlanSample {
+    int slot;          // Input slot
+    int vlan_id;
+    int inner_vlan_id; // -1 if none
+    InterfaceStats stats;
+} VlanSample;
+
+// Every counter read at once by the sampler thread, stamped with a single
+// CLOCK_MONOTONIC timestamp
+typedef struct Sample {
+    uint64_t timestamp;
+    InterfaceStats inputs[VX_MAX_INPUT_INTERFACES];   // By input slot
+    InterfaceStats outputs[VX_MAX_OUTPUT_INTERFACES]; // By output position
+    int vlan_count;
+    int vlan_capacity;
+    VlanSample* vlans; // Every VLAN key of every input plus the pairs, see sample_alloc()
+    int cpu_count;
+    int cpu_load[VX_MAX_CPUS]; // Percent use
+    uint64_t memory_used;
+    uint64_t memory_self;
+} Sample;
+
+int vlan_stats_mmap(int vlan_stats_fd);
+
+// Sampler thread side, collect_init() snapshots the configured interfaces
+int  collect_init(InterfaceCollection* collection);
+void collect_cleanup();
+int  collect_interfaces_data(Sample* sample);
+int  collect_cpus_data(CpuCollection* collection, Sample* sample);
+int  collect_memory_data(MemoryCollection* collection, Sample* sample);
+int  sample_alloc(Sample* sample);
+void sample_free(Sample* sample);
+void sample_copy(Sample* dst, const Sample* src);
+
+// UI side
+int  apply_interfaces_sample(InterfaceCollection* collection, const Sample* sample);
+void apply_cpus_sample(CpuCollection* collection, const Sample* sample);
+void apply_memory_sample(MemoryCollection* collection, const Sample* sample);
 
 #endif
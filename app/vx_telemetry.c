@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "vx_config.h"
+#include "vx_telemetry.h"
+
+// Headless mode: rates printed on the console as one record per line,
+// fields separated by spaces, the sample time (ms) second on every line
+static void print_interface(char type, uint64_t time, Interface* iface) {
+    printf("%c %"PRIu64" %s %s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+           type, time, iface->interface_name, iface->is_up ? "up" : "down",
+           iface->diff.rx_bytes, iface->diff.rx_packets, iface->diff.rx_dropped,
+           iface->diff.tx_bytes, iface->diff.tx_packets, iface->diff.tx_dropped);
+}
+
+static void print_vlan(uint64_t time, Vlan* vlan) {
+    // Idle VLANs are skipped, hundreds of them would outrun a serial line
+    if (!vlan->diff.rx_packets && !vlan->diff.rx_dropped)
+        return;
+    if (vlan->inner_vlan_id < 0)
+        printf("V %"PRIu64" %s.%d", time, vlan->parent->interface_name, vlan->vlan_id);
+    else
+        printf("V %"PRIu64" %s.%d.%d", time, vlan->parent->interface_name, vlan->vlan_id, vlan->inner_vlan_id);
+    printf(" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+           vlan->diff.rx_bytes, vlan->diff.rx_packets,
+           vlan->diff.rx_dropped_bytes, vlan->diff.rx_dropped);
+}
+
+void telemetry_print(InterfaceCollection* interfaces, const Sample* sample) {
+    static bool header = false;
+    uint64_t time = sample->timestamp / 1000000ULL;
+
+    if (!header) {
+        printf("# I|O ms name state rx_Bps rx_pps rx_drop_pps tx_Bps tx_pps tx_drop_pps\n");
+        printf("# V ms name.vlan[.inner] rx_Bps rx_pps drop_Bps drop_pps\n");
+        printf("# C ms load%%...\n");
+        printf("# M ms used_bytes self_bytes\n");
+        header = true;
+    }
+
+    for (Interface* iface = interfaces->input_head; iface; iface = iface->next) {
+        print_interface('I', time, iface);
+        for (Vlan* vlan = iface->vlan_stats; vlan; vlan = vlan->next)
+            print_vlan(time, vlan);
+    }
+    for (Interface* iface = interfaces->output_head; iface; iface = iface->next)
+        print_interface('O', time, iface);
+
+    printf("C %"PRIu64, time);
+    for (int i = 0; i < sample->cpu_count; i++)
+        printf(" %d", sample->cpu_load[i]);
+    printf("\nM %"PRIu64" %"PRIu64" %"PRIu64"\n", time, sample->memory_used, sample->memory_self);
+    fflush(stdout);
+}
@@ -0,0 +1,9 @@
+#ifndef VX_TELEMETRY
+#define VX_TELEMETRY
+
+#include "vx_models.h"
+#include "vx_stats.h"
+
+void telemetry_print(InterfaceCollection* interfaces, const Sample* sample);
+
+#endif
@@ -69,96 +69,97 @@ char* calculate_size(uint64_t size) {
     return result;
 }
 
-void interface_update_sma(Interface* interface) {
-    if (interface->buffer.count < 2)
-        return;
-    uint64_t diff_rx_bytes = 0, diff_rx_packets = 0, diff_rx_dropped = 0,
-             diff_tx_bytes = 0, diff_tx_packets = 0, diff_tx_dropped = 0;
-	double acc_rx_bytes = 0, acc_rx_packets = 0, acc_rx_dropped = 0,
-	       acc_tx_bytes = 0, acc_tx_packets = 0, acc_tx_dropped = 0;
-    int start = (interface->buffer.head + VX_NETWORK_CHART_SIZE + 1 - interface->buffer.count) % (VX_NETWORK_CHART_SIZE + 1);
-    for(int i = 0; i < interface->buffer.count - 1; i++) {
-         InterfaceStats *curr = &interface->buffer.data[(start + i + 1) % (VX_NETWORK_CHART_SIZE + 1)],
-                        *prev = &interface->buffer.data[(start + i) % (VX_NETWORK_CHART_SIZE + 1)];
-        diff_rx_bytes   = curr->rx_bytes   - prev->rx_bytes;
-        diff_rx_packets = curr->rx_packets - prev->rx_packets;
-        diff_rx_dropped = curr->rx_dropped - prev->rx_dropped;
-        diff_tx_bytes   = curr->tx_bytes   - prev->tx_bytes;
-        diff_tx_packets = curr->tx_packets - prev->tx_packets;
-        diff_tx_dropped = curr->tx_dropped - prev->tx_dropped;
-        if (interface->diff_max.rx_bytes < diff_rx_bytes)
-            interface->diff_max.rx_bytes = diff_rx_bytes;
-        if (interface->diff_max.rx_packets < diff_rx_packets)
-            interface->diff_max.rx_packets = diff_rx_packets;
-        if (interface->diff_max.rx_dropped < diff_rx_dropped)
-            interface->diff_max.rx_dropped = diff_rx_dropped;
-        if (interface->diff_max.tx_bytes < diff_tx_bytes)
-            interface->diff_max.tx_bytes = diff_tx_bytes;
-        if (interface->diff_max.tx_packets < diff_tx_packets)
-            interface->diff_max.tx_packets = diff_tx_packets;
-        if (interface->diff_max.tx_dropped < diff_tx_dropped)
-            interface->diff_max.tx_dropped = diff_tx_dropped;
-        if (curr->rx_bytes >= prev->rx_bytes)
-            acc_rx_bytes   += (double)diff_rx_bytes;
-        if (curr->rx_packets >= prev->rx_packets)
-            acc_rx_packets += (double)diff_rx_packets;
-        if (curr->rx_dropped >= prev->rx_dropped)
-            acc_rx_dropped += (double)diff_rx_dropped;
-        if (curr->tx_bytes >= prev->tx_bytes)
-            acc_tx_bytes   += (double)diff_tx_bytes;
-        if (curr->tx_packets >= prev->tx_packets)
-            acc_tx_packets += (double)diff_tx_packets;
-        if (curr->tx_dropped >= prev->tx_dropped)
-            acc_tx_dropped += (double)diff_tx_dropped;
-    }
-    interface->diff.rx_bytes   = diff_rx_bytes;
-    interface->diff.rx_packets = diff_rx_packets;
-    interface->diff.rx_dropped = diff_rx_dropped;
-    interface->diff.tx_bytes   = diff_tx_bytes;
-    interface->diff.tx_packets = diff_tx_packets;
-    interface->diff.tx_dropped = diff_tx_dropped;
-    interface->diff_sma.rx_bytes   = (uint64_t)(acc_rx_bytes   / (double)interface->buffer.count);
-    interface->diff_sma.rx_packets = (uint64_t)(acc_rx_packets / (double)interface->buffer.count);
-    interface->diff_sma.rx_dropped = (uint64_t)(acc_rx_dropped / (double)interface->buffer.count);
-    interface->diff_sma.tx_bytes   = (uint64_t)(acc_tx_bytes   / (double)interface->buffer.count);
-    interface->diff_sma.tx_packets = (uint64_t)(acc_tx_packets / (double)interface->buffer.count);
-    interface->diff_sma.tx_dropped = (uint64_t)(acc_tx_dropped / (double)interface->buffer.count);
+// Counter increase per second, from the real time between two samples.
+// A counter going backwards (reset) counts as no increase
+static uint64_t per_second(uint64_t curr, uint64_t prev, uint64_t elapsed) {
+    if (curr < prev)
+        return 0;
+    if (!elapsed)
+        return curr - prev;
+    return (uint64_t)((double)(curr - prev) * 1000000000.0 / (double)elapsed);
+}
+
+static uint64_t sample_interval(const InterfaceStats* curr, const InterfaceStats* prev) {
+    if (!prev->timestamp || curr->timestamp <= prev->timestamp)
+        return 0;
+    return curr->timestamp - prev->timestamp;
 }
-void vlan_update_sma(Vlan* vlan) {
-    if (vlan->buffer.count < 2)
+
+// History fields first, in VX_STAT_* order
+static const size_t stat_offsets[VX_STAT_FIELDS] = {
+    offsetof(InterfaceStats, rx_bytes),
+    offsetof(InterfaceStats, rx_packets),
+    offsetof(InterfaceStats, rx_dropped_bytes),
+    offsetof(InterfaceStats, rx_dropped),
+    offsetof(InterfaceStats, tx_bytes),
+    offsetof(InterfaceStats, tx_packets),
+    offsetof(InterfaceStats, tx_dropped),
+    offsetof(InterfaceStats, rx_truncated_bytes),
+    offsetof(InterfaceStats, rx_sampled_out),
+    offsetof(InterfaceStats, rx_duplicates),
+};
+#define STAT_FIELD(stats, field) (*(uint64_t*)((char*)(stats) + stat_offsets[field]))
+
+// Insert a sample: its per-second deltas join the history, the oldest ones
+// leave it once full. Sums and deques are updated in place, independently
+// of VX_NETWORK_CHART_SIZE
+static void buffer_push(InterfaceBuffer* buffer, InterfaceStats* diff, InterfaceStats* diff_max,
+                        InterfaceStats* diff_sma, InterfaceStats interface_stats) {
+    const int size = VX_NETWORK_CHART_SIZE;
+    InterfaceStats prev = buffer->last;
+    bool primed = buffer->primed;
+
+    buffer->last = interface_stats;
+    buffer->primed = true;
+    if (!primed)
         return;
-    uint64_t diff_rx_bytes = 0, diff_rx_packets = 0, diff_rx_dropped = 0, diff_rx_dropped_bytes = 0;
-    double    acc_rx_bytes = 0,  acc_rx_packets = 0,  acc_rx_dropped = 0,  acc_rx_dropped_bytes = 0;
-    int start = (vlan->buffer.head + VX_NETWORK_CHART_SIZE + 1 - vlan->buffer.count) % (VX_NETWORK_CHART_SIZE + 1);
-    for(int i = 0; i < vlan->buffer.count - 1; i++) {
-         InterfaceStats *curr = &vlan->buffer.data[(start + i + 1) % (VX_NETWORK_CHART_SIZE + 1)],
-                        *prev = &vlan->buffer.data[(start + i) % (VX_NETWORK_CHART_SIZE + 1)];
-        diff_rx_bytes         = curr->rx_bytes - prev->rx_bytes;
-        diff_rx_packets       = curr->rx_packets - prev->rx_packets;
-        diff_rx_dropped_bytes = curr->rx_dropped_bytes - prev->rx_dropped_bytes;
-        diff_rx_dropped       = curr->rx_dropped - prev->rx_dropped;
-        if (vlan->diff_max.rx_bytes < diff_rx_bytes)
-            vlan->diff_max.rx_bytes = diff_rx_bytes;
-        if (vlan->diff_max.rx_packets < diff_rx_packets)
-            vlan->diff_max.rx_packets = diff_rx_packets;
-        if (vlan->diff_max.rx_dropped_bytes < diff_rx_dropped_bytes)
-            vlan->diff_max.rx_dropped_bytes = diff_rx_dropped_bytes;
-        if (vlan->diff_max.rx_dropped < diff_rx_dropped)
-            vlan->diff_max.rx_dropped = diff_rx_dropped;
-
-        acc_rx_bytes         += (double)diff_rx_bytes;
-        acc_rx_packets       += (double)diff_rx_packets;
-        acc_rx_dropped_bytes += (double)diff_rx_dropped_bytes;
-        acc_rx_dropped       += (double)diff_rx_dropped;
+
+    uint64_t elapsed = sample_interval(&interface_stats, &prev);
+    for (int field = 0; field < VX_STAT_FIELDS; field++)
+        STAT_FIELD(diff, field) = per_second(STAT_FIELD(&interface_stats, field), STAT_FIELD(&prev, field), elapsed);
+
+    int position;
+    if (buffer->count < size) {
+        position = (buffer->head + buffer->count) % size;
+        buffer->count++;
+    } else {
+        // Full: the oldest delta leaves the window
+        position = buffer->head;
+        buffer->head = (buffer->head + 1) % size;
+        for (int field = 0; field < VX_HISTORY_FIELDS; field++) {
+            buffer->sum[field] -= buffer->delta[field][position];
+            if (buffer->deque_count[field] && buffer->deque[field][buffer->deque_head[field]] == position) {
+                buffer->deque_head[field] = (buffer->deque_head[field] + 1) % size;
+                buffer->deque_count[field]--;
+            }
+        }
+    }
+
+    for (int field = 0; field < VX_HISTORY_FIELDS; field++) {
+        uint64_t *delta = buffer->delta[field];
+        int *deque = buffer->deque[field];
+        uint64_t value = STAT_FIELD(diff, field);
+
+        delta[position] = delta[position + size] = value;
+        buffer->sum[field] += value;
+        // Smaller deltas can't be the max while this newer one is in the window
+        while (buffer->deque_count[field]
+               && delta[deque[(buffer->deque_head[field] + buffer->deque_count[field] - 1) % size]] <= value)
+            buffer->deque_count[field]--;
+        deque[(buffer->deque_head[field] + buffer->deque_count[field]) % size] = position;
+        buffer->deque_count[field]++;
+
+        STAT_FIELD(diff_max, field) = delta[deque[buffer->deque_head[field]]];
+        STAT_FIELD(diff_sma, field) = buffer->sum[field] / buffer->count;
     }
-    vlan->diff.rx_bytes         = diff_rx_bytes;
-    vlan->diff.rx_packets       = diff_rx_packets;
-    vlan->diff.rx_dropped_bytes = diff_rx_dropped_bytes;
-    vlan->diff.rx_dropped       = diff_rx_dropped;
-    vlan->diff_sma.rx_bytes         = (uint64_t)(acc_rx_bytes   / (double)vlan->buffer.count);
-    vlan->diff_sma.rx_packets       = (uint64_t)(acc_rx_packets / (double)vlan->buffer.count);
-    vlan->diff_sma.rx_dropped_bytes = (uint64_t)(acc_rx_dropped_bytes / (double)vlan->buffer.count);
-    vlan->diff_sma.rx_dropped       = (uint64_t)(acc_rx_dropped / (double)vlan->buffer.count);
+}
+
+void interface_update_sma(Interface* interface, InterfaceStats interface_stats) {
+    buffer_push(&interface->buffer, &interface->diff, &interface->diff_max, &interface->diff_sma, interface_stats);
+}
+
+void vlan_update_sma(Vlan* vlan, InterfaceStats interface_stats) {
+    buffer_push(&vlan->buffer, &vlan->diff, &vlan->diff_max, &vlan->diff_sma, interface_stats);
 }
 
 // Function to find the highest set bit position in a value
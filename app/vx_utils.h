@@ -6,8 +6,8 @@
 
 char* calculate_size(uint64_t size);
 
-void interface_update_sma(Interface* interface);
-void vlan_update_sma(Vlan* vlan);
+void interface_update_sma(Interface* interface, InterfaceStats interface_stats);
+void vlan_update_sma(Vlan* vlan, InterfaceStats interface_stats);
 
 int highest_set_bit_position(uint64_t value);
 
@@ -5,8 +5,10 @@
 #include <pthread.h>
 #include <netlink/route/link.h>
 
+#include "vx_capture.h"
 #include "vx_config.h"
 #include "vx_models.h"
+#include "vx_network.h"
 #include "vx_stats.h"
 #include "vx_utils.h"
 #include "vx_view.h"
@@ -247,6 +249,12 @@ void* select_interface(void* args) {
                         if (interfaces_chart_change_visibility() < 0)
                             exit(EXIT_FAILURE);
                     }
+                    break;
+                case KEY_C:
+                    capture_view_toggle();
+                    break;
+                case KEY_W:
+                    capture_dump(VX_CAPTURE_FILE);
                 }
                 pthread_mutex_unlock(&main_mutex);
             }
@@ -257,19 +265,20 @@ void* select_interface(void* args) {
 
 
 void interfaces_refresh() {
-    Interface* iface = interface_collection->input_head;
-    Vlan*      vlan  = NULL;
-
-    while (iface) {
-        vlan = iface->vlan_stats;
-        while (vlan) {
-            Interface_refresh(vlan->parent);
-            Interface_refresh(vlan->redirection);
+    Interface* iface;
+    Vlan*      vlan;
+
+    // Link state comes from the notification-driven cache
+    if (rtnl_update() < 0)
+        return;
+
+    for (iface = interface_collection->input_head; iface; iface = iface->next)
+        Interface_refresh(iface);
+    for (iface = interface_collection->output_head; iface; iface = iface->next)
+        Interface_refresh(iface);
+    for (iface = interface_collection->input_head; iface; iface = iface->next)
+        for (vlan = iface->vlan_stats; vlan; vlan = vlan->next)
             Vlan_refresh(vlan);
-            vlan = vlan->next;
-        }
-        iface = iface->next;
-    }
 }
 
 static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t val, vx_display flag) {
@@ -311,7 +320,7 @@ static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t va
     switch (flag) {
     // Bytes
     case VX_RX_BYTES:
-        lv_label_set_text_fmt(label, "Total Rx: %s | Rx byte/s: %s/s | Rx byte/s (avg. last %lds) %s/s", str_val, str_diff, count - 1, str_sma);
+        lv_label_set_text_fmt(label, "Total Rx: %s | Rx byte/s: %s/s | Rx byte/s (avg. last %lds) %s/s", str_val, str_diff, count, str_sma);
         switch (iface->type) {
         case VX_CLASS_INPUT_INTERFACE:  lv_obj_set_style_text_color(label, VX_INPUT_RX_COLOR, 0); break;
         case VX_CLASS_OUTPUT_INTERFACE: lv_obj_set_style_text_color(label, VX_OUTPUT_RX_COLOR, 0); break;
@@ -319,7 +328,7 @@ static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t va
         }
         break;
     case VX_TX_BYTES:
-        lv_label_set_text_fmt(label, "Total Tx: %s | Tx byte/s: %s/s | Tx byte/s (avg. last %lds) %s/s", str_val, str_diff, count - 1, str_sma);
+        lv_label_set_text_fmt(label, "Total Tx: %s | Tx byte/s: %s/s | Tx byte/s (avg. last %lds) %s/s", str_val, str_diff, count, str_sma);
         switch (iface->type) {
         case VX_CLASS_INPUT_INTERFACE:  lv_obj_set_style_text_color(label, VX_INPUT_TX_COLOR, 0); break;
         case VX_CLASS_OUTPUT_INTERFACE: lv_obj_set_style_text_color(label, VX_OUTPUT_TX_COLOR, 0); break;
@@ -327,7 +336,7 @@ static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t va
         }
         break;
     case VX_RX_DROPPED_BYTES:
-        lv_label_set_text_fmt(label, "Dropped Rx: %s | Rx byte/s: %s/s | Rx byte/s (avg. last %lds) %s/s", str_val, str_diff, count - 1, str_sma);
+        lv_label_set_text_fmt(label, "Dropped Rx: %s | Rx byte/s: %s/s | Rx byte/s (avg. last %lds) %s/s", str_val, str_diff, count, str_sma);
         switch (iface->type) {
         case VX_CLASS_INPUT_INTERFACE:  lv_obj_set_style_text_color(label, VX_INPUT_RXD_COLOR, 0); break;
         case VX_CLASS_OUTPUT_INTERFACE: lv_obj_set_style_text_color(label, VX_OUTPUT_RXD_COLOR, 0); break;
@@ -336,7 +345,7 @@ static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t va
         break;
     // Packets
     case VX_RX_PACKETS:
-        lv_label_set_text_fmt(label, "Total Rx pkt: %"PRIu64" | Rx pkt/s: %"PRIu64"/s | Rx pkt/s (avg. last %lds) %"PRIu64"/s", val, diff, count - 1, sma);
+        lv_label_set_text_fmt(label, "Total Rx pkt: %"PRIu64" | Rx pkt/s: %"PRIu64"/s | Rx pkt/s (avg. last %lds) %"PRIu64"/s", val, diff, count, sma);
         switch (iface->type) {
         case VX_CLASS_INPUT_INTERFACE:  lv_obj_set_style_text_color(label, VX_INPUT_RX_COLOR, 0); break;
         case VX_CLASS_OUTPUT_INTERFACE: lv_obj_set_style_text_color(label, VX_OUTPUT_RX_COLOR, 0); break;
@@ -344,7 +353,7 @@ static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t va
         }
         break;
     case VX_TX_PACKETS:
-        lv_label_set_text_fmt(label, "Total Tx pkt: %"PRIu64" | Tx pkt/s: %"PRIu64"/s | Tx pkt/s (avg. last %lds) %"PRIu64"/s", val, diff, count - 1, sma);
+        lv_label_set_text_fmt(label, "Total Tx pkt: %"PRIu64" | Tx pkt/s: %"PRIu64"/s | Tx pkt/s (avg. last %lds) %"PRIu64"/s", val, diff, count, sma);
         switch (iface->type) {
         case VX_CLASS_INPUT_INTERFACE:  lv_obj_set_style_text_color(label, VX_INPUT_TX_COLOR, 0); break;
         case VX_CLASS_OUTPUT_INTERFACE: lv_obj_set_style_text_color(label, VX_OUTPUT_TX_COLOR, 0); break;
@@ -352,7 +361,7 @@ static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t va
         }
         break;
     case VX_RX_DROPPED:
-        lv_label_set_text_fmt(label, "Total Rx drop: %"PRIu64" | Rx drop/s: %"PRIu64"/s | Rx drop/s (avg. last %lds) %"PRIu64"/s", val, diff, count - 1, sma);
+        lv_label_set_text_fmt(label, "Total Rx drop: %"PRIu64" | Rx drop/s: %"PRIu64"/s | Rx drop/s (avg. last %lds) %"PRIu64"/s", val, diff, count, sma);
         switch (iface->type) {
         case VX_CLASS_INPUT_INTERFACE:  lv_obj_set_style_text_color(label, VX_INPUT_RXD_COLOR, 0); break;
         case VX_CLASS_OUTPUT_INTERFACE: lv_obj_set_style_text_color(label, VX_OUTPUT_RXD_COLOR, 0); break;
@@ -360,7 +369,7 @@ static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t va
         }
         break;
     case VX_TX_DROPPED:
-        lv_label_set_text_fmt(label, "Total Tx drop: %"PRIu64" | Tx drop/s: %"PRIu64"/s | Tx drop/s (avg. last %lds) %"PRIu64"/s", val, diff, count - 1, sma);
+        lv_label_set_text_fmt(label, "Total Tx drop: %"PRIu64" | Tx drop/s: %"PRIu64"/s | Tx drop/s (avg. last %lds) %"PRIu64"/s", val, diff, count, sma);
         switch (iface->type) {
         case VX_CLASS_INPUT_INTERFACE:  lv_obj_set_style_text_color(label, VX_INPUT_TXD_COLOR, 0); break;
         case VX_CLASS_OUTPUT_INTERFACE: lv_obj_set_style_text_color(label, VX_OUTPUT_TXD_COLOR, 0); break;
@@ -379,177 +388,144 @@ static int update_interface_label(lv_obj_t* label, Interface* iface, uint64_t va
     return 0;
 }
 
-int interface_series_update(Interface* iface, int type) {
-    int curr_i = (iface->buffer.head + VX_NETWORK_CHART_SIZE) % (VX_NETWORK_CHART_SIZE + 1),
-        prev_i = (iface->buffer.head + VX_NETWORK_CHART_SIZE - 1) % (VX_NETWORK_CHART_SIZE + 1);
-    InterfaceStats *curr = &iface->buffer.data[curr_i],
-                   *prev = &iface->buffer.data[prev_i],
-                   *vcurr = NULL,
-                   *vprev = NULL;
+// Rebuild a series from a contiguous delta window, oldest first
+static void series_fill(lv_chart_series_t* series, const uint64_t* deltas, int count, int shift_amount, int sign) {
+    int32_t* points = lv_chart_get_y_array(interface_collection->network_chart, series);
+    int empty = VX_NETWORK_CHART_SIZE - count;
+
+    for (int i = 0; i < empty; i++)
+        points[i] = LV_CHART_POINT_NONE;
+    for (int i = 0; i < count; i++)
+        points[empty + i] = sign * (int32_t)(deltas[i] >> shift_amount);
+    lv_chart_set_x_start_point(interface_collection->network_chart, series, 0);
+}
+
+static uint64_t newest_delta(const InterfaceBuffer* buffer, int field) {
+    return buffer->count ? buffer->delta[field][buffer->head + buffer->count - 1] : 0;
+}
+
+static int series_shift(uint64_t max) {
+    int shift_amount = highest_set_bit_position(max) - VX_NETWORK_CHART_RANGE_SHIFT_MAX + 1;
+    return shift_amount < 0 ? 0 : shift_amount;
+}
 
+// Only the selected interface or VLAN has series, in the current display
+// mode: push its newest point, or rebuild the series from the history when
+// the scale changed or they were just created
+static void interface_series_update(Interface* iface) {
+    InterfaceBuffer* buffer = &iface->buffer;
     uint64_t max = 0;
-    int* scale;
+    int shift_amount;
 
-    // Interfaces
-    lv_chart_series_t *r_series,  *t_series,  *rd_series,  *td_series;
-    switch (type) {
+    switch (selector.display_mode) {
     case VX_DISPLAY_BYTES:
+        if (!iface->rx_bytes || !iface->tx_bytes)
+            return;
         max = (iface->diff_max.rx_bytes > iface->diff_max.tx_bytes ?
             iface->diff_max.rx_bytes : iface->diff_max.tx_bytes
         );
-        scale = &iface->bytes_scale;
-        r_series  = iface->rx_bytes;
-        t_series  = iface->tx_bytes;
-        rd_series = NULL;
-        td_series = NULL;
+        shift_amount = series_shift(max);
+        // Scale changed, rebuild all series for interface from the history
+        if (shift_amount != iface->bytes_scale) {
+            series_fill(iface->rx_bytes, &buffer->delta[VX_STAT_RX_BYTES][buffer->head], buffer->count, shift_amount,  1);
+            series_fill(iface->tx_bytes, &buffer->delta[VX_STAT_TX_BYTES][buffer->head], buffer->count, shift_amount, -1);
+            lv_chart_refresh(interface_collection->network_chart);
+            iface->bytes_scale = shift_amount;
+        // Same shift, simple insert
+        } else {
+            lv_chart_set_next_value(interface_collection->network_chart, iface->rx_bytes,  (newest_delta(buffer, VX_STAT_RX_BYTES) >> shift_amount));
+            lv_chart_set_next_value(interface_collection->network_chart, iface->tx_bytes, -(newest_delta(buffer, VX_STAT_TX_BYTES) >> shift_amount));
+        }
         break;
     case VX_DISPLAY_PACKETS:
+        if (!iface->rx_packets || !iface->tx_packets || !iface->rx_dropped || !iface->tx_dropped)
+            return;
         max = (iface->diff_max.rx_packets > iface->diff_max.tx_packets ?
             iface->diff_max.rx_packets > iface->diff_max.rx_dropped ?
                 iface->diff_max.rx_packets : iface->diff_max.rx_dropped
         :   iface->diff_max.tx_packets > iface->diff_max.rx_dropped ?
                 iface->diff_max.tx_packets : iface->diff_max.rx_dropped
         );
-        scale = &iface->packets_scale;
-        r_series  = iface->rx_packets;
-        t_series  = iface->tx_packets;
-        rd_series = iface->rx_dropped;
-        td_series = iface->tx_dropped;
+        shift_amount = series_shift(max);
+        if (shift_amount != iface->packets_scale) {
+            series_fill(iface->rx_packets, &buffer->delta[VX_STAT_RX_PACKETS][buffer->head], buffer->count, shift_amount,  1);
+            series_fill(iface->tx_packets, &buffer->delta[VX_STAT_TX_PACKETS][buffer->head], buffer->count, shift_amount, -1);
+            series_fill(iface->rx_dropped, &buffer->delta[VX_STAT_RX_DROPPED][buffer->head], buffer->count, shift_amount,  1);
+            series_fill(iface->tx_dropped, &buffer->delta[VX_STAT_TX_DROPPED][buffer->head], buffer->count, shift_amount, -1);
+            lv_chart_refresh(interface_collection->network_chart);
+            iface->packets_scale = shift_amount;
+        } else {
+            lv_chart_set_next_value(interface_collection->network_chart, iface->rx_packets,  (newest_delta(buffer, VX_STAT_RX_PACKETS) >> shift_amount));
+            lv_chart_set_next_value(interface_collection->network_chart, iface->tx_packets, -(newest_delta(buffer, VX_STAT_TX_PACKETS) >> shift_amount));
+            lv_chart_set_next_value(interface_collection->network_chart, iface->rx_dropped,  (newest_delta(buffer, VX_STAT_RX_DROPPED) >> shift_amount));
+            lv_chart_set_next_value(interface_collection->network_chart, iface->tx_dropped, -(newest_delta(buffer, VX_STAT_TX_DROPPED) >> shift_amount));
+        }
         break;
     }
+}
 
-    int shift_amount = highest_set_bit_position(max) - VX_NETWORK_CHART_RANGE_SHIFT_MAX + 1;
-    if (shift_amount < 0)
-        shift_amount = 0;
-
-    // Scale changed, reset all series for interface
-    if (shift_amount != *scale) {
-        lv_chart_set_all_value(interface_collection->network_chart, r_series, LV_CHART_POINT_NONE);
-        lv_chart_set_all_value(interface_collection->network_chart, t_series, LV_CHART_POINT_NONE);
+static void vlan_series_update(Vlan* vlan) {
+    InterfaceBuffer* buffer = &vlan->buffer;
+    lv_chart_series_t *r_series, *rd_series;
+    int r_field, rd_field;
+    uint64_t max = 0;
+    int* scale;
 
-        int start = (iface->buffer.head + VX_NETWORK_CHART_SIZE + 1 - iface->buffer.count) % (VX_NETWORK_CHART_SIZE + 1);
-        for (int i = 0; i < (iface->buffer.count - 1); i++) {
-            InterfaceStats *curr = &iface->buffer.data[(start + i + 1) % (VX_NETWORK_CHART_SIZE + 1)],
-                           *prev = &iface->buffer.data[(start + i) % (VX_NETWORK_CHART_SIZE + 1)];
+    switch (selector.display_mode) {
+    case VX_DISPLAY_BYTES:
+        max = (vlan->diff_max.rx_bytes > vlan->diff_max.rx_dropped_bytes ?
+            vlan->diff_max.rx_bytes : vlan->diff_max.rx_dropped_bytes
+        );
+        scale     = &vlan->bytes_scale;
+        r_series  = vlan->rx_bytes;
+        rd_series = vlan->rx_dropped_bytes;
+        r_field   = VX_STAT_RX_BYTES;
+        rd_field  = VX_STAT_RX_DROPPED_BYTES;
+        break;
+    case VX_DISPLAY_PACKETS:
+        max = (vlan->diff_max.rx_packets > vlan->diff_max.rx_dropped ?
+            vlan->diff_max.rx_packets : vlan->diff_max.rx_dropped
+        );
+        scale     = &vlan->packets_scale;
+        r_series  = vlan->rx_packets;
+        rd_series = vlan->rx_dropped;
+        r_field   = VX_STAT_RX_PACKETS;
+        rd_field  = VX_STAT_RX_DROPPED;
+        break;
+    default:
+        return;
+    }
+    if (!r_series || !rd_series)
+        return;
 
-            uint64_t r_diff;
-            uint64_t t_diff;
-            switch (type) {
-            case VX_DISPLAY_BYTES:
-                r_diff = curr->rx_bytes - prev->rx_bytes;
-                t_diff = curr->tx_bytes - prev->tx_bytes;
-                lv_chart_set_next_value(interface_collection->network_chart, r_series,  (r_diff >> shift_amount));
-                lv_chart_set_next_value(interface_collection->network_chart, t_series, -(t_diff >> shift_amount));
-                break;
-            case VX_DISPLAY_PACKETS:
-                r_diff = curr->rx_packets - prev->rx_packets;
-                t_diff = curr->tx_packets - prev->tx_packets;
-                lv_chart_set_next_value(interface_collection->network_chart, r_series,  (r_diff >> shift_amount));
-                lv_chart_set_next_value(interface_collection->network_chart, t_series, -(t_diff >> shift_amount));
-                r_diff = curr->rx_dropped - prev->rx_dropped;
-                t_diff = curr->tx_dropped - prev->tx_dropped;
-                lv_chart_set_next_value(interface_collection->network_chart, rd_series,  (r_diff >> shift_amount));
-                lv_chart_set_next_value(interface_collection->network_chart, td_series, -(t_diff >> shift_amount));
-                break;
-            }
-        }
+    int shift_amount = series_shift(max);
 
+    // Scale changed, rebuild all series for VLAN from the history
+    if (shift_amount != *scale) {
+        series_fill(r_series,  &buffer->delta[r_field][buffer->head],  buffer->count, shift_amount, 1);
+        series_fill(rd_series, &buffer->delta[rd_field][buffer->head], buffer->count, shift_amount, 1);
+        lv_chart_refresh(interface_collection->network_chart);
         *scale = shift_amount;
-    // Same shift, simple insert
     } else {
-        switch (type) {
-        case VX_DISPLAY_BYTES:
-            lv_chart_set_next_value(interface_collection->network_chart, r_series,  (iface->diff.rx_bytes >> shift_amount));
-            lv_chart_set_next_value(interface_collection->network_chart, t_series, -(iface->diff.tx_bytes >> shift_amount));
-            break;
-        case VX_DISPLAY_PACKETS:
-            lv_chart_set_next_value(interface_collection->network_chart, r_series,  (iface->diff.rx_packets >> shift_amount));
-            lv_chart_set_next_value(interface_collection->network_chart, t_series, -(iface->diff.tx_packets >> shift_amount));
-            lv_chart_set_next_value(interface_collection->network_chart, rd_series,  (iface->diff.rx_dropped >> shift_amount));
-            lv_chart_set_next_value(interface_collection->network_chart, td_series, -(iface->diff.tx_dropped >> shift_amount));
-            break;
-        }
+        lv_chart_set_next_value(interface_collection->network_chart, r_series,  (newest_delta(buffer, r_field) >> shift_amount));
+        lv_chart_set_next_value(interface_collection->network_chart, rd_series, (newest_delta(buffer, rd_field) >> shift_amount));
     }
+}
 
-    // Vlans
-    for (Vlan* vlan = iface->vlan_stats; vlan != NULL; vlan = vlan->next) {
-        lv_chart_series_t *vr_series, *vrd_series;
-        switch (type) {
-        case VX_DISPLAY_BYTES:
-            max = (vlan->diff_max.rx_bytes > vlan->diff_max.rx_dropped_bytes ?
-                vlan->diff_max.rx_bytes : vlan->diff_max.rx_dropped_bytes
-            );
-            scale = &vlan->bytes_scale; 
-            vr_series  = vlan->rx_bytes;
-            vrd_series = vlan->rx_dropped_bytes;
-            break;
-        case VX_DISPLAY_PACKETS:
-            max = (vlan->diff_max.rx_packets > vlan->diff_max.rx_dropped ?
-                vlan->diff_max.rx_packets : vlan->diff_max.rx_dropped
-            );
-            scale = &vlan->packets_scale; 
-            vr_series  = vlan->rx_packets;
-            vrd_series = vlan->rx_dropped;
-            break;
-        }
-
-        int shift_amount = highest_set_bit_position(max) - VX_NETWORK_CHART_RANGE_SHIFT_MAX + 1;
-        if (shift_amount < 0)
-            shift_amount = 0;
-
-        // Scale changed, reset all series for interface
-        if (shift_amount != *scale) {
-            lv_chart_set_all_value(interface_collection->network_chart, vr_series, LV_CHART_POINT_NONE);
-            lv_chart_set_all_value(interface_collection->network_chart, vrd_series, LV_CHART_POINT_NONE);
-
-            int start = (vlan->buffer.head + VX_NETWORK_CHART_SIZE + 1 - vlan->buffer.count) % (VX_NETWORK_CHART_SIZE + 1);
-            int vcurr_i = (iface->buffer.head + VX_NETWORK_CHART_SIZE) % (VX_NETWORK_CHART_SIZE + 1),
-                vprev_i = (iface->buffer.head + VX_NETWORK_CHART_SIZE - 1) % (VX_NETWORK_CHART_SIZE + 1);
-            for (int i = 0; i < (vlan->buffer.count - 1); i++) {
-                vcurr = &vlan->buffer.data[(start + i + 1) % (VX_NETWORK_CHART_SIZE + 1)];
-                vprev = &vlan->buffer.data[(start + i) % (VX_NETWORK_CHART_SIZE + 1)];
-                uint64_t vr_diff;
-                switch (type) {
-                case VX_DISPLAY_BYTES:
-                    vr_diff = vcurr->rx_bytes - vprev->rx_bytes;
-                    lv_chart_set_next_value(interface_collection->network_chart, vr_series, (vr_diff >> shift_amount));
-                    vr_diff = vcurr->rx_dropped_bytes - vprev->rx_dropped_bytes;
-                    lv_chart_set_next_value(interface_collection->network_chart, vrd_series, (vr_diff >> shift_amount));
-                    break;
-                case VX_DISPLAY_PACKETS:
-                    vr_diff = vcurr->rx_packets - vprev->rx_packets;
-                    lv_chart_set_next_value(interface_collection->network_chart, vr_series, (vr_diff >> shift_amount));
-                    vr_diff = vcurr->rx_dropped - vprev->rx_dropped;
-                    lv_chart_set_next_value(interface_collection->network_chart, vrd_series, (vr_diff >> shift_amount));
-                    break;
-                }
-            }
-        } else {
-            switch (type) {
-            case VX_DISPLAY_BYTES:
-                lv_chart_set_next_value(interface_collection->network_chart, vr_series, (vlan->diff.rx_bytes >> shift_amount));
-                lv_chart_set_next_value(interface_collection->network_chart, vrd_series, (vlan->diff.rx_dropped_bytes >> shift_amount));
-                break;
-            case VX_DISPLAY_PACKETS:
-                lv_chart_set_next_value(interface_collection->network_chart, vr_series, (vlan->diff.rx_packets >> shift_amount));
-                lv_chart_set_next_value(interface_collection->network_chart, vrd_series, (vlan->diff.rx_dropped >> shift_amount));
-                break;
-            }
-        }
-    }
-    return curr_i;
+static void selected_series_update() {
+    Interface* interface = (Interface*)selector.selected;
+    if (interface->type == VX_CLASS_VLAN)
+        vlan_series_update((Vlan*)selector.selected);
+    else
+        interface_series_update(interface);
 }
 
 int interfaces_chart_update() {
-    if (collect_interfaces_data(interface_collection) < 0)
-        return -1;
+    selected_series_update();
 
     // Input
-    int curr_i = 0;
     for (Interface* iface = interface_collection->input_head; iface != NULL; iface = iface->next) {
-        interface_series_update(iface, VX_DISPLAY_BYTES);
-        curr_i = interface_series_update(iface, VX_DISPLAY_PACKETS);
-        InterfaceStats *curr = &iface->buffer.data[curr_i];
+        InterfaceStats *curr = &iface->buffer.last;
 
         // Labels
         if (selector.selected == iface) {
@@ -568,19 +544,19 @@ int interfaces_chart_update() {
             }
         } else {
             for (Vlan* vlan = iface->vlan_stats; vlan != NULL; vlan = vlan->next) {
-                int curr_i = (vlan->buffer.head + VX_NETWORK_CHART_SIZE) % (VX_NETWORK_CHART_SIZE + 1);
+                InterfaceStats *curr = &vlan->buffer.last;
                 if (selector.selected == vlan) {
                     switch (selector.display_mode) {
                     case VX_DISPLAY_BYTES:
-                        update_interface_label(interface_collection->network_rx_label, (Interface*)vlan, vlan->buffer.data[curr_i].rx_bytes, VX_RX_BYTES);
+                        update_interface_label(interface_collection->network_rx_label, (Interface*)vlan, curr->rx_bytes, VX_RX_BYTES);
                         update_interface_label(interface_collection->network_tx_label, (Interface*)vlan, 0, VX_NONE);
-                        update_interface_label(interface_collection->network_rxd_label, (Interface*)vlan, vlan->buffer.data[curr_i].rx_dropped_bytes, VX_RX_DROPPED_BYTES);
+                        update_interface_label(interface_collection->network_rxd_label, (Interface*)vlan, curr->rx_dropped_bytes, VX_RX_DROPPED_BYTES);
                         update_interface_label(interface_collection->network_txd_label, (Interface*)vlan, 0, VX_NONE);
                         break;
                     case VX_DISPLAY_PACKETS:
-                        update_interface_label(interface_collection->network_rx_label, (Interface*)vlan, vlan->buffer.data[curr_i].rx_packets, VX_RX_PACKETS);
+                        update_interface_label(interface_collection->network_rx_label, (Interface*)vlan, curr->rx_packets, VX_RX_PACKETS);
                         update_interface_label(interface_collection->network_tx_label, (Interface*)vlan, 0, VX_NONE);
-                        update_interface_label(interface_collection->network_rxd_label, (Interface*)vlan, vlan->buffer.data[curr_i].rx_dropped, VX_RX_DROPPED);
+                        update_interface_label(interface_collection->network_rxd_label, (Interface*)vlan, curr->rx_dropped, VX_RX_DROPPED);
                         update_interface_label(interface_collection->network_txd_label, (Interface*)vlan, 0, VX_NONE);
                     }
                 }
@@ -590,9 +566,7 @@ int interfaces_chart_update() {
 
     // Output
     for (Interface* iface = interface_collection->output_head; iface != NULL; iface = iface->next) {
-        interface_series_update(iface, VX_DISPLAY_BYTES);
-        curr_i = interface_series_update(iface, VX_DISPLAY_PACKETS);
-        InterfaceStats *curr = &iface->buffer.data[curr_i];
+        InterfaceStats *curr = &iface->buffer.last;
 
         // Labels
         if (selector.selected == iface) {
@@ -645,10 +619,10 @@ int interfaces_chart_change_visibility() {
             return -1;
         vlan = interface->vlan_stats;
         while (vlan) {
-            if (vlan->line)
-                lv_obj_set_style_line_opa(vlan->line, LV_OPA_100, 0);
-            if (vlan->redirection)
-                lv_obj_set_style_image_opa(vlan->redirection->image, LV_OPA_100, 0);
+            for (int i = 0; i < vlan->redirection_count; i++) {
+                lv_obj_set_style_line_opa(vlan->lines[i], LV_OPA_100, 0);
+                lv_obj_set_style_image_opa(vlan->redirections[i]->image, LV_OPA_100, 0);
+            }
             vlan = vlan->next;
         }
         lv_label_set_text_fmt(interface_collection->network_label, "\uf053 %s bandwidth \uf054", interface->interface_name);
@@ -660,9 +634,11 @@ int interfaces_chart_change_visibility() {
         while (iface) {
             vlan = iface->vlan_stats;
             while (vlan) {
-                if (vlan->redirection == interface) {
-                    lv_obj_set_style_line_opa(vlan->line, LV_OPA_100, 0);
-                    lv_obj_set_style_image_opa(vlan->parent->image, LV_OPA_100, 0);
+                for (int i = 0; i < vlan->redirection_count; i++) {
+                    if (vlan->redirections[i] == interface) {
+                        lv_obj_set_style_line_opa(vlan->lines[i], LV_OPA_100, 0);
+                        lv_obj_set_style_image_opa(vlan->parent->image, LV_OPA_100, 0);
+                    }
                 }
                 vlan = vlan->next;
             }
@@ -674,17 +650,21 @@ int interfaces_chart_change_visibility() {
         if (Vlan_set_focus(vlan, true, selector.display_mode) < 0)
             return -1;
         lv_obj_set_style_image_opa(vlan->parent->image, LV_OPA_100, 0);
-        if (vlan->redirection)
-            lv_obj_set_style_image_opa(vlan->redirection->image, LV_OPA_100, 0);
-        lv_label_set_text_fmt(interface_collection->network_label, "\uf053 %s.%d bandwidth \uf054", vlan->parent->interface_name, vlan->vlan_id);
+        for (int i = 0; i < vlan->redirection_count; i++)
+            lv_obj_set_style_image_opa(vlan->redirections[i]->image, LV_OPA_100, 0);
+        if (vlan->inner_vlan_id < 0)
+            lv_label_set_text_fmt(interface_collection->network_label, "\uf053 %s.%d bandwidth \uf054", vlan->parent->interface_name, vlan->vlan_id);
+        else
+            lv_label_set_text_fmt(interface_collection->network_label, "\uf053 %s.%d.%d bandwidth \uf054", vlan->parent->interface_name, vlan->vlan_id, vlan->inner_vlan_id);
         break;
     }
+
+    // The selection got new series, build them from its history
+    selected_series_update();
     return 0;
 }
 
 int cpus_chart_update(CpuCollection* collection) {
-    if (collect_cpus_data(collection) < 0)
-        return -1;
     Cpu* cpu = NULL;
     cpu = collection->head;
     while (cpu) {
@@ -696,8 +676,6 @@ int cpus_chart_update(CpuCollection* collection) {
 }
 
 int memory_chart_update(MemoryCollection* collection) {
-    if (collect_memory_data(collection) < 0)
-        return -1;
     Memory* memory = NULL;
     memory = collection->head;
     while (memory) {
@@ -3,6 +3,9 @@
 #include <linux/in.h>
 #include <linux/if_ether.h>
 #include <linux/if_vlan.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
 #include <bpf/bpf_endian.h>
 #include <bpf/bpf_helpers.h>
 
@@ -83,27 +86,269 @@ struct vlan_stat {
 	__u64 packets;
 	__u64 dropped_bytes;
 	__u64 dropped;
+	__u64 truncated_bytes; // Removed by snaplen, bytes counts the original length
+	__u64 sampled_out;     // Skipped by 1:N sampling, not counted as dropped
+	__u64 duplicates;      // Repeats removed by dedup, not counted as dropped
 };
 
-// Define a map to store per-VLAN redirect interfaces
+// Per-VLAN redirect action, indexed by VLAN ID
 // 0 -> untagged (default)
 // 1..4094 -> tagged N
-// 4095 -> all
+// 4095 -> all (folded into every slot by userspace)
+#define VLAN_ACTION_RULE      0x1
+#define VLAN_ACTION_BROADCAST 0x2 // Clone to every output of tx_sets[output_set]
+#define VLAN_ACTION_SAMPLE_FLOW 0x4 // Sample on the flow hash instead of a random draw
+#define VLAN_ACTION_GROUP     0x8 // Send to one member of tx_groups[output_set], by symmetric flow hash
+#define VLAN_ACTION_TAG_PUSH    0x10 // Push an 802.1Q tag with tag_vid
+#define VLAN_ACTION_TAG_REWRITE 0x20 // Set the outer VID to tag_vid (push on untagged frames)
+#define VLAN_ACTION_TAG_STRIP   0x40 // Remove the outer tag
+#define VLAN_ACTION_CAPTURE     0x80 // Copy the start of the frame to capture_ring
+struct vlan_action {
+	__u32 ifindex; // tx_ports key (first output of a set), 0 -> drop
+	__u32 flags;
+	__u32 output_set; // tx_sets or tx_groups index
+	__u32 snaplen; // Truncate mirrored frames to this length, 0 -> whole frame
+	__u32 sample_rate; // Mirror 1 frame out of sample_rate, 0 or 1 -> all
+	__u32 filter; // filters index of the L3/L4 match, 0 -> none
+	__u32 dedup_window; // Drop repeats seen within this many microseconds, 0 -> off
+	__u32 tag_vid; // VID of the TAG_PUSH / TAG_REWRITE actions
+	__u32 tunnel; // tunnels index of the remote SPAN encapsulation, 0 -> none
+};
+
+// One program and one set of maps for every input: userspace gives each
+// attached interface a slot, per-input maps hold a block of entries per slot
+// and are resized by userspace to the number of inputs
+#define MAX_INPUTS 10 // VX_MAX_INPUT_INTERFACES
+#define VLAN_COUNT 4096
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, __u32);   // ingress ifindex
+	__type(value, __u32); // input slot
+	__uint(max_entries, MAX_INPUTS);
+} inputs SEC(".maps");
+
+// Indexed by input slot * VLAN_COUNT + VLAN ID
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
 	__type(key, __u32);
-	__type(value, __u32);
-	__uint(max_entries, 4096);
+	__type(value, struct vlan_action);
+	__uint(max_entries, VLAN_COUNT * MAX_INPUTS);
 } vlan_redirect_map SEC(".maps");
 
-// Define a map to store per-VLAN statistics (bytes and packets)
+// Per-(outer, inner) redirect action for stacked tags (802.1ad S-tag + C-tag)
+// Checked before vlan_redirect_map, userspace folds the outer VLAN and "any"
+// rules into each entry
+#define QINQ_KEY(slot, outer, inner) (0x1000000 | ((slot) << 25) | ((outer) << 12) | (inner))
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__type(key, __u32);
-	__type(value, struct vlan_stat);
-	__uint(max_entries, 4096);
+	__type(value, struct vlan_action);
+	__uint(max_entries, 1024 * MAX_INPUTS); // VX_MAX_QINQ_RULES per input
+} qinq_redirect_map SEC(".maps");
+
+// Define a map to store output devices, keyed by interface index
+// Redirecting through a devmap lets the kernel bulk frames per NAPI poll
+struct {
+	__uint(type, BPF_MAP_TYPE_DEVMAP_HASH);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, 16); // >= VX_MAX_OUTPUT_INTERFACES
+} tx_ports SEC(".maps");
+
+// Define per-rule output sets for multi-destination VLANs
+// Each inner devmap holds every output of the set, frames are cloned to all
+// of them with BPF_F_BROADCAST
+struct tx_set {
+	__uint(type, BPF_MAP_TYPE_DEVMAP_HASH);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, 16); // >= VX_MAX_OUTPUT_INTERFACES
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+	__type(key, __u32);
+	__uint(max_entries, 64); // VX_MAX_OUTPUT_SETS per input, resized by userspace
+	__array(values, struct tx_set);
+} tx_sets SEC(".maps");
+
+// L3/L4 filters, indexed by filter ID (1..VX_MAX_FILTERS * inputs - 1)
+// A frame matches when every field present in flags matches
+#define FILTER_SRC   0x1 // Source address in filter_src
+#define FILTER_DST   0x2 // Destination address in filter_dst
+#define FILTER_PROTO 0x4 // IP protocol equals proto
+struct filter {
+	__u32 flags;
+	__u16 sport_min; // Port ranges, 0-65535 -> any
+	__u16 sport_max;
+	__u16 dport_min;
+	__u16 dport_max;
+	__u8  proto;
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct filter);
+	__uint(max_entries, 64); // VX_MAX_FILTERS per input, resized by userspace
+} filters SEC(".maps");
+
+// Address prefixes of each filter, IPv4 stored as IPv4-mapped IPv6
+// The filter ID is part of the key, prefixlen counts its 32 bits
+struct filter_key {
+	__u32 prefixlen;
+	__u32 filter;
+	__u32 addr[4];
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__type(key, struct filter_key);
+	__type(value, __u32);
+	__uint(max_entries, 1024); // VX_MAX_FILTER_PREFIXES per input, resized by userspace
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+} filter_src SEC(".maps");
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__type(key, struct filter_key);
+	__type(value, __u32);
+	__uint(max_entries, 1024); // VX_MAX_FILTER_PREFIXES per input, resized by userspace
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+} filter_dst SEC(".maps");
+
+// Per-filter hit counters, frames that miss are neither mirrored nor dropped
+struct filter_stat {
+	__u64 hits;
+	__u64 misses;
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct filter_stat);
+	__uint(max_entries, 64); // VX_MAX_FILTERS per input, resized by userspace
+} filter_stats SEC(".maps");
+
+// Define load-balanced output groups
+// Each flow goes to a single member, both directions to the same one
+#define TX_GROUP_SIZE 16 // >= VX_MAX_OUTPUT_INTERFACES
+struct tx_group {
+	__u32 count;
+	__u32 ifindex[TX_GROUP_SIZE]; // tx_ports keys
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct tx_group);
+	__uint(max_entries, 64); // VX_MAX_OUTPUT_GROUPS per input, resized by userspace
+} tx_groups SEC(".maps");
+
+// Remote SPAN tunnels, indexed by tunnel ID (1..VX_MAX_TUNNELS * inputs - 1)
+// Userspace fills the outer headers for an empty payload (IPv4 total length,
+// checksum and UDP length), only the frame length dependent fields and the
+// sequence numbers are updated per frame
+#define TUNNEL_GRE     1 // Ethernet over GRE (transparent Ethernet bridging)
+#define TUNNEL_ERSPAN2 2 // ERSPAN type II
+#define TUNNEL_ERSPAN3 3 // ERSPAN type III
+#define TUNNEL_VXLAN   4
+#define TUNNEL_GRE_LEN     38 // Ethernet + IPv4 + GRE
+#define TUNNEL_ERSPAN2_LEN 50 // Ethernet + IPv4 + GRE with sequence + ERSPAN II
+#define TUNNEL_ERSPAN3_LEN 54 // Ethernet + IPv4 + GRE with sequence + ERSPAN III
+#define TUNNEL_VXLAN_LEN   50 // Ethernet + IPv4 + UDP + VXLAN
+#define TUNNEL_HEADER_MAX  64
+struct tunnel {
+	__u32 type;
+	__u32 seq; // GRE sequence number (ERSPAN)
+	__u8  header[TUNNEL_HEADER_MAX];
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct tunnel);
+	__uint(max_entries, 16); // VX_MAX_TUNNELS per input, resized by userspace
+} tunnels SEC(".maps");
+
+// On-box capture of the frames of one VLAN, the start of each frame is copied
+// to userspace while the frame itself is redirected as usual
+#define CAPTURE_SNAPLEN 128
+struct capture_record {
+	__u64 timestamp; // bpf_ktime_get_ns
+	__u32 ifindex;
+	__u32 vlan_id;
+	__u32 len;
+	__u32 caplen;
+	__u8  data[CAPTURE_SNAPLEN];
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 256 * 1024);
+} capture_ring SEC(".maps");
+
+// Recently mirrored frames, keyed by a hash of their invariant fields
+// Shared by every input so copies of a frame captured on two ports are
+// caught, LRU lists are per CPU
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, __u64);
+	__type(value, __u64); // First seen, ns
+	__uint(max_entries, 65536);
+	__uint(map_flags, BPF_F_NO_COMMON_LRU);
+} dedup_map SEC(".maps");
+
+// Define a map to store per-VLAN statistics (bytes and packets)
+// Keyed by input slot * VLAN_COUNT + VLAN ID (0..4095), one slot per CPU:
+// counters are updated without atomics and summed by userspace.
+// Userspace mmaps the array and reads it with plain loads, the per-CPU slots
+// of a key follow each other (index key * stats_cpus + CPU), one cache line
+// each. Resized by userspace to the inputs and possible CPUs
+const volatile __u32 stats_cpus SEC(".rodata.stats") = 1;
+struct vlan_counters {
+	struct vlan_stat stat;
+	__u64 padding; // 64 bytes
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct vlan_counters);
+	__uint(max_entries, VLAN_COUNT * MAX_INPUTS);
+	__uint(map_flags, BPF_F_MMAPABLE);
 } vlan_stats SEC(".maps");
 
+// Define a map to store per-(outer, inner) statistics
+// Entries are created by userspace for each configured pair
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__type(key, __u32);
+	__type(value, struct vlan_stat);
+	__uint(max_entries, 1024 * MAX_INPUTS); // VX_MAX_QINQ_RULES per input
+} qinq_stats SEC(".maps");
+
+// Tail-call pipeline, shared by every input: the entry program reads the tags
+// and redirects plain rules itself, only rules using other features continue
+// in the stages (needs_classify / needs_action). Userspace installs the
+// stages some input needs, missing stages drop the frame
+#define STAGE_CLASSIFY 0 // L3/L4 match, dedup, sampling, capture, group hash
+#define STAGE_ACTION   1 // Snaplen, tag and tunnel actions
+struct {
+	__uint(type, BPF_MAP_TYPE_PROG_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, 2);
+} pipeline SEC(".maps");
+
+// State handed from one stage to the next, stored in front of the frame
+// (bpf_xdp_adjust_meta) or in a per-CPU slot when the driver has no room
+// for metadata: tail calls run on the same CPU
+struct pipeline_meta {
+	__u32 input;      // Input slot * VLAN_COUNT, base of the vlan_* keys
+	__u32 vlan_id;
+	__u32 qinq_key;   // Set when an (outer, inner) rule matched
+	__u32 size;       // Wire length, before any truncation
+	__u32 group_hash; // Symmetric flow hash of GROUP rules
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct pipeline_meta);
+	__uint(max_entries, 1);
+} pipeline_scratch SEC(".maps");
+
 struct dot1q {
 	unsigned char h_dest[6];   /* destination eth addr */
 	unsigned char h_source[6]; /* source ether addr	*/
@@ -111,25 +356,430 @@ struct dot1q {
 	__be16 vlan_tcid; /* VLAN TCI field	   */
 };
 
-static __always_inline void update_statistics(__u32 vlan_id, int size) {
-	struct vlan_stat *stats = bpf_map_lookup_elem(&vlan_stats, &vlan_id);
-	if (stats) {
-		NO_TEAR_ADD(stats->bytes, size);
-		NO_TEAR_INC(stats->packets);
+struct dot1ad {
+	unsigned char h_dest[6];   /* destination eth addr */
+	unsigned char h_source[6]; /* source ether addr	*/
+	__be16 h_proto;	    /* outer TPID */
+	__be16 vlan_tcid;   /* outer TCI  */
+	__be16 inner_proto; /* inner TPID */
+	__be16 inner_tcid;  /* inner TCI  */
+};
+
+struct vlan_tag {
+	__be16 tci;               /* VLAN TCI field */
+	__be16 encapsulated_proto; /* next TPID or packet type ID */
+};
+
+// IP flow identifiers, left zeroed for non-IP frames
+struct flow {
+	__u32 saddr[4];
+	__u32 daddr[4];
+	__u16 sport;
+	__u16 dport;
+	__u8  proto;
+	__u8  ip_version; // 4, 6 or 0 for non-IP frames
+	__u32 ip_id;      // IPv4 identification or IPv6 flow label
+	__u16 ip_len;     // IPv4 total length or IPv6 payload length
+	__u16 payload_offset; // L3 payload, from the start of the frame
+};
+
+// Walk up to two VLAN tags then the IPv4/IPv6 header and the TCP/UDP ports
+// Fragments keep zero ports so every fragment of a flow gets the same hash
+static __always_inline void parse_flow(void *data, void *data_end, struct flow *flow) {
+	struct ethhdr *eth = data;
+	void *cursor = data + sizeof(*eth);
+	__be16 h_proto = eth->h_proto;
+	void *l4 = NULL;
+
+	#pragma unroll
+	for (int i = 0; i < 2; i++) {
+		if (h_proto != bpf_htons(ETH_P_8021Q) && h_proto != bpf_htons(ETH_P_8021AD))
+			break;
+		struct vlan_tag *tag = cursor;
+		if ((void*)tag + sizeof(*tag) > data_end)
+			return;
+		h_proto = tag->encapsulated_proto;
+		cursor += sizeof(*tag);
+	}
+
+	if (h_proto == bpf_htons(ETH_P_IP)) {
+		struct iphdr *ip = cursor;
+		if ((void*)ip + sizeof(*ip) > data_end)
+			return;
+		flow->saddr[0] = ip->saddr;
+		flow->daddr[0] = ip->daddr;
+		flow->proto = ip->protocol;
+		flow->ip_version = 4;
+		flow->ip_id = bpf_ntohs(ip->id);
+		flow->ip_len = bpf_ntohs(ip->tot_len);
+		flow->payload_offset = cursor + ip->ihl * 4 - data;
+		if (!(ip->frag_off & bpf_htons(0x3fff))) // MF or fragment offset
+			l4 = cursor + ip->ihl * 4;
+	} else if (h_proto == bpf_htons(ETH_P_IPV6)) {
+		struct ipv6hdr *ip6 = cursor;
+		if ((void*)ip6 + sizeof(*ip6) > data_end)
+			return;
+		__builtin_memcpy(flow->saddr, &ip6->saddr, sizeof(flow->saddr));
+		__builtin_memcpy(flow->daddr, &ip6->daddr, sizeof(flow->daddr));
+		flow->proto = ip6->nexthdr;
+		flow->ip_version = 6;
+		flow->ip_id = ((__u32)(ip6->flow_lbl[0] & 0x0f) << 16) | ((__u32)ip6->flow_lbl[1] << 8) | ip6->flow_lbl[2];
+		flow->ip_len = bpf_ntohs(ip6->payload_len);
+		flow->payload_offset = cursor + sizeof(*ip6) - data;
+		l4 = cursor + sizeof(*ip6);
+	}
+
+	if (l4 && (flow->proto == IPPROTO_TCP || flow->proto == IPPROTO_UDP)) {
+		struct udphdr *ports = l4; // TCP and UDP share the port layout
+		if ((void*)ports + sizeof(*ports) > data_end)
+			return;
+		flow->sport = bpf_ntohs(ports->source);
+		flow->dport = bpf_ntohs(ports->dest);
+	}
+}
+
+static __always_inline __u32 hash_mix(__u32 hash, __u32 value) {
+	hash ^= value;
+	hash *= 0x9e3779b1;
+	return hash ^ (hash >> 15);
+}
+
+static __always_inline __u32 flow_hash(const struct flow *flow) {
+	__u32 hash = flow->proto;
+	#pragma unroll
+	for (int i = 0; i < 4; i++) {
+		hash = hash_mix(hash, flow->saddr[i]);
+		hash = hash_mix(hash, flow->daddr[i]);
+	}
+	return hash_mix(hash, ((__u32)flow->sport << 16) | flow->dport);
+}
+
+// Same value for both directions of a flow: each address word and the ports
+// are mixed as (min, max) pairs
+static __always_inline __u32 flow_hash_symmetric(const struct flow *flow) {
+	__u32 hash = flow->proto;
+	#pragma unroll
+	for (int i = 0; i < 4; i++) {
+		__u32 a = flow->saddr[i], b = flow->daddr[i];
+		hash = hash_mix(hash, a < b ? a : b);
+		hash = hash_mix(hash, a < b ? b : a);
+	}
+	if (flow->sport < flow->dport)
+		return hash_mix(hash, ((__u32)flow->sport << 16) | flow->dport);
+	return hash_mix(hash, ((__u32)flow->dport << 16) | flow->sport);
+}
+
+// Hash the fields a frame keeps across a routed hop (not TTL, checksum, MACs
+// or VLAN tags) and the start of its payload, repeats within the window are
+// duplicates
+#define DEDUP_PAYLOAD 32
+static __always_inline int is_duplicate(struct xdp_md *ctx, const struct flow *flow, int size, __u32 window) {
+	__u32 payload[DEDUP_PAYLOAD / 4] = {};
+	int len = size - flow->payload_offset;
+
+	if (!flow->ip_version)
+		return 0;
+	if (len > DEDUP_PAYLOAD)
+		len = DEDUP_PAYLOAD;
+	if (len > 0 && bpf_xdp_load_bytes(ctx, flow->payload_offset, payload, len) < 0)
+		return 0;
+
+	__u32 hash = hash_mix(flow->ip_id, flow->ip_len);
+	#pragma unroll
+	for (int i = 0; i < DEDUP_PAYLOAD / 4; i++)
+		hash = hash_mix(hash, payload[i]);
+	__u64 key = ((__u64)flow_hash(flow) << 32) | hash;
+	__u64 now = bpf_ktime_get_ns();
+	__u64 *seen = bpf_map_lookup_elem(&dedup_map, &key);
+	if (seen && now - *seen < (__u64)window * 1000)
+		return 1;
+	bpf_map_update_elem(&dedup_map, &key, &now, BPF_ANY);
+	return 0;
+}
+
+static __always_inline int match_prefix(void *trie, __u32 filter_id, const struct flow *flow, const __u32 *addr) {
+	struct filter_key key = {.prefixlen = 32 + 128, .filter = filter_id};
+	if (flow->ip_version == 4) {
+		key.addr[2] = bpf_htonl(0xffff);
+		key.addr[3] = addr[0];
 	} else {
-		struct vlan_stat new_stats = {.bytes = size, .packets = 1, .dropped_bytes = 0, .dropped = 0};
-		bpf_map_update_elem(&vlan_stats, &vlan_id, &new_stats, BPF_ANY);
+		__builtin_memcpy(key.addr, addr, sizeof(key.addr));
 	}
+	return bpf_map_lookup_elem(trie, &key) != NULL;
+}
+
+static __always_inline int match_filter(__u32 filter_id, const struct flow *flow) {
+	struct filter *filter = bpf_map_lookup_elem(&filters, &filter_id);
+	if (!filter || !flow->ip_version)
+		return 0;
+	if ((filter->flags & FILTER_PROTO) && flow->proto != filter->proto)
+		return 0;
+	if (flow->sport < filter->sport_min || flow->sport > filter->sport_max
+		|| flow->dport < filter->dport_min || flow->dport > filter->dport_max)
+		return 0;
+	if ((filter->flags & FILTER_SRC) && !match_prefix(&filter_src, filter_id, flow, flow->saddr))
+		return 0;
+	if ((filter->flags & FILTER_DST) && !match_prefix(&filter_dst, filter_id, flow, flow->daddr))
+		return 0;
+	return 1;
 }
-static __always_inline void register_drop(__u32 vlan_id, int size) {
-	struct vlan_stat *stats = bpf_map_lookup_elem(&vlan_stats, &vlan_id);
+
+static __always_inline void update_filter_statistics(__u32 filter_id, int hit) {
+	struct filter_stat *stats = bpf_map_lookup_elem(&filter_stats, &filter_id);
+	if (stats) {
+		if (hit)
+			stats->hits++;
+		else
+			stats->misses++;
+	}
+}
+
+// Egress tag action, done once before the redirect so every clone carries it
+// Packet pointers are invalidated by bpf_xdp_adjust_head
+static __always_inline int apply_tag(struct xdp_md *ctx, __u32 flags, __u16 vid) {
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct dot1q *vlan_hdr = data;
+	unsigned char macs[12];
+
+	if ((void*)vlan_hdr + sizeof(struct ethhdr) > data_end)
+		return -1;
+	int tagged = vlan_hdr->h_proto == bpf_htons(ETH_P_8021Q) || vlan_hdr->h_proto == bpf_htons(ETH_P_8021AD);
+	if (tagged && (void*)vlan_hdr + sizeof(*vlan_hdr) > data_end)
+		return -1;
+
+	if (flags & VLAN_ACTION_TAG_STRIP) {
+		if (!tagged)
+			return 0;
+		__builtin_memcpy(macs, vlan_hdr, sizeof(macs));
+		if (bpf_xdp_adjust_head(ctx, (int)sizeof(__be16) * 2))
+			return -1;
+		data_end = (void *)(long)ctx->data_end;
+		data = (void *)(long)ctx->data;
+		if (data + sizeof(struct ethhdr) > data_end)
+			return -1;
+		__builtin_memcpy(data, macs, sizeof(macs));
+		return 0;
+	}
+	if ((flags & VLAN_ACTION_TAG_REWRITE) && tagged) {
+		vlan_hdr->vlan_tcid = bpf_htons((bpf_ntohs(vlan_hdr->vlan_tcid) & ~VLAN_VID_MASK) | vid);
+		return 0;
+	}
+
+	// Push, the original EtherType becomes the encapsulated one
+	__builtin_memcpy(macs, vlan_hdr, sizeof(macs));
+	if (bpf_xdp_adjust_head(ctx, -(int)sizeof(__be16) * 2))
+		return -1;
+	data_end = (void *)(long)ctx->data_end;
+	data = (void *)(long)ctx->data;
+	vlan_hdr = data;
+	if ((void*)vlan_hdr + sizeof(*vlan_hdr) > data_end)
+		return -1;
+	__builtin_memcpy(vlan_hdr, macs, sizeof(macs));
+	vlan_hdr->h_proto = bpf_htons(ETH_P_8021Q);
+	vlan_hdr->vlan_tcid = bpf_htons(vid);
+	return 0;
+}
+
+static __always_inline void capture(struct xdp_md *ctx, __u32 vlan_id, int size) {
+	struct capture_record *record = bpf_ringbuf_reserve(&capture_ring, sizeof(*record), 0);
+	if (!record)
+		return;
+	__u32 caplen = size < CAPTURE_SNAPLEN ? size : CAPTURE_SNAPLEN;
+	if (caplen < 1 || caplen > CAPTURE_SNAPLEN || bpf_xdp_load_bytes(ctx, 0, record->data, caplen) < 0)
+		caplen = 0;
+	record->timestamp = bpf_ktime_get_ns();
+	record->ifindex = ctx->ingress_ifindex;
+	record->vlan_id = vlan_id;
+	record->len = size;
+	record->caplen = caplen;
+	bpf_ringbuf_submit(record, 0);
+}
+
+static __always_inline void *push_header(struct xdp_md *ctx, const __u8 *header, const int len) {
+	if (bpf_xdp_adjust_head(ctx, -len))
+		return NULL;
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	if (data + len > data_end)
+		return NULL;
+	__builtin_memcpy(data, header, len);
+	return data;
+}
+
+// Remote SPAN: prepend the outer headers of the tunnel, the frame then leaves
+// through the transport output of the rule
+static __always_inline int apply_encap(struct xdp_md *ctx, __u32 tunnel_id, __u32 vlan_id) {
+	struct tunnel *tunnel = bpf_map_lookup_elem(&tunnels, &tunnel_id);
+	int inner_len = ctx->data_end - ctx->data;
+	void *outer;
+
+	if (!tunnel)
+		return -1;
+	// VXLAN source port from the inner flow (RFC 7348) so ECMP and the
+	// collector RSS spread the copies, the outer UDP checksum stays 0
+	__be16 sport = 0;
+	if (tunnel->type == TUNNEL_VXLAN) {
+		struct flow flow = {};
+		parse_flow((void *)(long)ctx->data, (void *)(long)ctx->data_end, &flow);
+		sport = bpf_htons(49152 | (hash_mix(flow_hash(&flow), vlan_id) & 0x3fff));
+	}
+	switch (tunnel->type) {
+	case TUNNEL_GRE:
+		outer = push_header(ctx, tunnel->header, TUNNEL_GRE_LEN);
+		break;
+	case TUNNEL_ERSPAN2:
+		outer = push_header(ctx, tunnel->header, TUNNEL_ERSPAN2_LEN);
+		break;
+	case TUNNEL_ERSPAN3:
+		outer = push_header(ctx, tunnel->header, TUNNEL_ERSPAN3_LEN);
+		break;
+	case TUNNEL_VXLAN:
+		outer = push_header(ctx, tunnel->header, TUNNEL_VXLAN_LEN);
+		break;
+	default:
+		return -1;
+	}
+	if (!outer)
+		return -1;
+
+	// IPv4 total length and incremental checksum update
+	struct iphdr *ip = outer + sizeof(struct ethhdr);
+	__u32 csum = (~bpf_ntohs(ip->check) & 0xffff) + inner_len;
+	csum = (csum & 0xffff) + (csum >> 16);
+	csum = (csum & 0xffff) + (csum >> 16);
+	ip->tot_len = bpf_htons(bpf_ntohs(ip->tot_len) + inner_len);
+	ip->check = bpf_htons(~csum & 0xffff);
+
+	if (tunnel->type == TUNNEL_VXLAN) {
+		struct udphdr *udp = (void*)ip + sizeof(*ip);
+		udp->len = bpf_htons(bpf_ntohs(udp->len) + inner_len);
+		udp->source = sport;
+	} else if (tunnel->type == TUNNEL_ERSPAN2 || tunnel->type == TUNNEL_ERSPAN3) {
+		__be32 *gre_seq = (void*)ip + sizeof(*ip) + 4;
+		__be16 *erspan = (void*)gre_seq + 4;
+		*gre_seq = bpf_htonl(__sync_fetch_and_add(&tunnel->seq, 1));
+		if (tunnel->type == TUNNEL_ERSPAN2) {
+			// Version 1, original VLAN, Encapsulation type 802.1Q if tagged
+			erspan[0] = bpf_htons((1 << 12) | vlan_id);
+			if (vlan_id)
+				erspan[1] |= bpf_htons(2 << 11);
+		} else {
+			// Version 2, original VLAN, 100us timestamp granularity
+			erspan[0] = bpf_htons((2 << 12) | vlan_id);
+			*(__be32 *)&erspan[2] = bpf_htonl(bpf_ktime_get_ns() / 100000);
+		}
+	}
+	return 0;
+}
+
+static __always_inline struct vlan_stat *vlan_stat(__u32 key) {
+	__u32 index = key * stats_cpus + bpf_get_smp_processor_id();
+	struct vlan_counters *counters = bpf_map_lookup_elem(&vlan_stats, &index);
+	return counters ? &counters->stat : NULL;
+}
+static __always_inline struct vlan_stat *qinq_stat(__u32 key) {
+	return bpf_map_lookup_elem(&qinq_stats, &key);
+}
+
+static __always_inline void update_statistics(struct vlan_stat *stats, int size, int truncated) {
 	if (stats) {
-		NO_TEAR_ADD(stats->dropped_bytes, size);
-		NO_TEAR_INC(stats->dropped);
+		stats->bytes += size;
+		stats->packets++;
+		stats->truncated_bytes += truncated;
+	}
+}
+static __always_inline void register_sampled_out(struct vlan_stat *stats) {
+	if (stats)
+		stats->sampled_out++;
+}
+static __always_inline void register_duplicate(struct vlan_stat *stats) {
+	if (stats)
+		stats->duplicates++;
+}
+static __always_inline void register_drop(struct vlan_stat *stats, int size) {
+	if (stats) {
+		stats->dropped_bytes += size;
+		stats->dropped++;
+	}
+}
+
+static __always_inline int drop(const struct pipeline_meta *state) {
+	register_drop(vlan_stat(state->input + state->vlan_id), state->size);
+	register_drop(vlan_stat(state->input + 4095), state->size);
+	if (state->qinq_key)
+		register_drop(qinq_stat(state->qinq_key), state->size);
+	return XDP_DROP;
+}
+
+static __always_inline int needs_classify(const struct vlan_action *action) {
+	return action->filter || action->dedup_window || action->sample_rate > 1
+		|| (action->flags & (VLAN_ACTION_GROUP | VLAN_ACTION_CAPTURE));
+}
+
+static __always_inline int needs_action(const struct vlan_action *action) {
+	return action->snaplen || action->tunnel
+		|| (action->flags & (VLAN_ACTION_TAG_PUSH | VLAN_ACTION_TAG_REWRITE | VLAN_ACTION_TAG_STRIP));
+}
+
+static __always_inline struct vlan_action *lookup_action(const struct pipeline_meta *state) {
+	__u32 key = state->input + state->vlan_id;
+	if (state->qinq_key)
+		return bpf_map_lookup_elem(&qinq_redirect_map, &state->qinq_key);
+	return bpf_map_lookup_elem(&vlan_redirect_map, &key);
+}
+
+static __always_inline struct pipeline_meta *pipeline_meta(struct xdp_md *ctx) {
+	void *data = (void *)(long)ctx->data;
+	struct pipeline_meta *meta = (void *)(long)ctx->data_meta;
+	__u32 zero = 0;
+
+	if ((void*)(meta + 1) <= data)
+		return meta;
+	return bpf_map_lookup_elem(&pipeline_scratch, &zero);
+}
+
+// Only returns if the stage isn't installed
+static __always_inline void next_stage(struct xdp_md *ctx, const struct pipeline_meta *state, __u32 stage) {
+	struct pipeline_meta *meta = pipeline_meta(ctx);
+	if (!meta)
+		return;
+	*meta = *state;
+	bpf_tail_call(ctx, &pipeline, stage);
+}
+
+static __always_inline int redirect(const struct vlan_action *action, const struct pipeline_meta *state, int truncated) {
+	long ret;
+
+	if (action->flags & VLAN_ACTION_BROADCAST) {
+		void *outputs = bpf_map_lookup_elem(&tx_sets, &action->output_set);
+		if (!outputs)
+			return drop(state);
+		ret = bpf_redirect_map(outputs, 0, BPF_F_BROADCAST | BPF_F_EXCLUDE_INGRESS);
+	} else if (action->flags & VLAN_ACTION_GROUP) {
+		struct tx_group *group = bpf_map_lookup_elem(&tx_groups, &action->output_set);
+		if (!group || !group->count)
+			return drop(state);
+		__u32 member = state->group_hash % group->count;
+		if (member >= TX_GROUP_SIZE)
+			return drop(state);
+		ret = bpf_redirect_map(&tx_ports, group->ifindex[member], 0);
 	} else {
-		struct vlan_stat new_stats = {.bytes = 0, .packets = 0, .dropped_bytes = 1, .dropped = 1};
-		bpf_map_update_elem(&vlan_stats, &vlan_id, &new_stats, BPF_ANY);
+		ret = bpf_redirect_map(&tx_ports, action->ifindex, 0);
 	}
+	if (ret != XDP_REDIRECT)
+		return drop(state);
+
+	// Update statistics for specific VLAN
+	update_statistics(vlan_stat(state->input + state->vlan_id), state->size, truncated);
+
+	// Update statistics for global redirection
+	update_statistics(vlan_stat(state->input + 4095), state->size, truncated);
+
+	// Update statistics for (outer, inner) pair
+	if (state->qinq_key)
+		update_statistics(qinq_stat(state->qinq_key), state->size, truncated);
+	return XDP_REDIRECT;
 }
 
 SEC("xdp")
@@ -138,57 +788,148 @@ int xdp_vlan_filter(struct xdp_md *ctx) {
 	void *data = (void *)(long)ctx->data;
 	struct ethhdr *eth = data;
 	struct dot1q *vlan_hdr;
-	__u32 vlan_id = 0; // Default VLAN ID for untagged packets
-	__u32 *ifindex = NULL;
-	__u32 global_vlan_key = 4095; // Key for global redirection
+	struct dot1ad *qinq_hdr;
+	struct vlan_action *action = NULL;
+	__u32 ifindex = ctx->ingress_ifindex;
+	__u32 *slot = bpf_map_lookup_elem(&inputs, &ifindex);
+	__u32 key;
+	if (!slot || *slot >= MAX_INPUTS)
+		return XDP_DROP;
+	struct pipeline_meta state = {
+		.input = *slot * VLAN_COUNT,
+		.vlan_id = 0, // Default VLAN ID for untagged packets
+		.qinq_key = 0,
+		.size = data_end - data,
+	};
 
 	// Check if the packet is large enough to contain Ethernet header
-	if ((void*)eth + sizeof(*eth) > data_end) {
-		register_drop(vlan_id, data_end - data);
-		register_drop(global_vlan_key, data_end - data);
-		return XDP_DROP;
-	}
+	if ((void*)eth + sizeof(*eth) > data_end)
+		return drop(&state);
 
 	// Check if the packet has VLAN tag
 	if (eth->h_proto == bpf_htons(ETH_P_8021Q) || eth->h_proto == bpf_htons(ETH_P_8021AD)) {
 		vlan_hdr = (void*)eth;
-		if ((void*)vlan_hdr + sizeof(*vlan_hdr) > data_end) {
-			register_drop(vlan_id, data_end - data);
-			register_drop(global_vlan_key, data_end - data);
-			return XDP_DROP;
+		if ((void*)vlan_hdr + sizeof(*vlan_hdr) > data_end)
+			return drop(&state);
+		state.vlan_id = bpf_ntohs(vlan_hdr->vlan_tcid) & VLAN_VID_MASK;
+
+		// Stacked tag: S-tag + C-tag (or double 802.1Q)
+		qinq_hdr = (void*)eth;
+		if ((void*)qinq_hdr + sizeof(*qinq_hdr) <= data_end
+			&& (qinq_hdr->inner_proto == bpf_htons(ETH_P_8021Q) || qinq_hdr->inner_proto == bpf_htons(ETH_P_8021AD))) {
+			state.qinq_key = QINQ_KEY(*slot, state.vlan_id, bpf_ntohs(qinq_hdr->inner_tcid) & VLAN_VID_MASK);
 		}
-		vlan_id = bpf_ntohs(vlan_hdr->vlan_tcid) & VLAN_VID_MASK;
 	}
 
-	// Lookup global redirect interface (if any)
-	__u32 *global_ifindex = bpf_map_lookup_elem(&vlan_redirect_map, &global_vlan_key);
+	// Redirect the packet to the specified interface(s)
+	// (outer, inner) rules first, then the outer VLAN rule
+	if (state.qinq_key) {
+		action = bpf_map_lookup_elem(&qinq_redirect_map, &state.qinq_key);
+		if (!action)
+			state.qinq_key = 0;
+	}
+	if (!action) {
+		key = state.input + state.vlan_id;
+		action = bpf_map_lookup_elem(&vlan_redirect_map, &key);
+	}
+	// No redirection criteria matched or interface index is 0, drop the packet
+	if (!action || action->ifindex == 0)
+		return drop(&state);
+
+	// Plain rules are redirected here, the others go through the pipeline
+	if (needs_classify(action) || needs_action(action)) {
+		// Metadata is optional, pipeline_meta falls back to the per-CPU slot
+		bpf_xdp_adjust_meta(ctx, -(int)sizeof(struct pipeline_meta));
+		next_stage(ctx, &state, needs_classify(action) ? STAGE_CLASSIFY : STAGE_ACTION);
+		return drop(&state);
+	}
+	return redirect(action, &state, 0);
+}
+
+SEC("xdp")
+int xdp_stage_classify(struct xdp_md *ctx) {
+	struct pipeline_meta *meta = pipeline_meta(ctx);
+	if (!meta)
+		return XDP_DROP;
+	struct pipeline_meta state = *meta;
+	struct vlan_action *action = lookup_action(&state);
+	if (!action)
+		return drop(&state);
+
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct flow flow = {};
+	if (action->filter || action->dedup_window || (action->flags & (VLAN_ACTION_SAMPLE_FLOW | VLAN_ACTION_GROUP)))
+		parse_flow(data, data_end, &flow);
 
-	if (global_ifindex && *global_ifindex != 0) {
-		if (bpf_redirect(*global_ifindex, 0) == XDP_REDIRECT) {
-			// Update statistics for specific VLAN
-			update_statistics(vlan_id, data_end - data);
+	// L3/L4 match, frames outside of the filter are not selected by the rule
+	if (action->filter) {
+		int hit = match_filter(action->filter, &flow);
+		update_filter_statistics(action->filter, hit);
+		if (!hit)
+			return XDP_DROP;
+	}
 
-			// Update statistics for global redirection
-			update_statistics(global_vlan_key, data_end - data);
-			return XDP_REDIRECT;
-		}
+	// Copy of a frame already mirrored from another port
+	if (action->dedup_window && is_duplicate(ctx, &flow, state.size, action->dedup_window)) {
+		register_duplicate(vlan_stat(state.input + state.vlan_id));
+		register_duplicate(vlan_stat(state.input + 4095));
+		if (state.qinq_key)
+			register_duplicate(qinq_stat(state.qinq_key));
+		return XDP_DROP;
 	}
 
-	// Redirect the packet to the specified interface
-	ifindex = bpf_map_lookup_elem(&vlan_redirect_map, &vlan_id);
-	if (ifindex && *ifindex != 0) {
-		if (bpf_redirect(*ifindex, 0) == XDP_REDIRECT) {
-			// Update statistics for specific VLAN
-			update_statistics(vlan_id, data_end - data);
-			update_statistics(global_vlan_key, data_end - data);
-			return XDP_REDIRECT;
+	// 1:N sampling, per frame or per flow so a flow is kept or skipped as a whole
+	if (action->sample_rate > 1) {
+		__u32 draw;
+		if (action->flags & VLAN_ACTION_SAMPLE_FLOW) {
+			draw = flow_hash(&flow);
+		} else {
+			draw = bpf_get_prandom_u32();
+		}
+		if (draw % action->sample_rate) {
+			register_sampled_out(vlan_stat(state.input + state.vlan_id));
+			register_sampled_out(vlan_stat(state.input + 4095));
+			if (state.qinq_key)
+				register_sampled_out(qinq_stat(state.qinq_key));
+			return XDP_DROP;
 		}
 	}
+	// Frame as received, before truncation and tag / tunnel actions
+	if (action->flags & VLAN_ACTION_CAPTURE)
+		capture(ctx, state.vlan_id, state.size);
 
-	// No redirection criteria matched or interface index is 0, drop the packet
-	register_drop(vlan_id, data_end - data);
-	register_drop(global_vlan_key, data_end - data);
-	return XDP_DROP;
+	if (action->flags & VLAN_ACTION_GROUP)
+		state.group_hash = flow_hash_symmetric(&flow);
+	if (needs_action(action)) {
+		next_stage(ctx, &state, STAGE_ACTION);
+		return drop(&state);
+	}
+	return redirect(action, &state, 0);
+}
+
+SEC("xdp")
+int xdp_stage_action(struct xdp_md *ctx) {
+	struct pipeline_meta *meta = pipeline_meta(ctx);
+	if (!meta)
+		return XDP_DROP;
+	struct pipeline_meta state = *meta;
+	struct vlan_action *action = lookup_action(&state);
+	int truncated = 0;
+	if (!action)
+		return drop(&state);
+
+	// Keep only the first snaplen bytes, the clones share the shrunk frame
+	if (action->snaplen && state.size > action->snaplen) {
+		if (bpf_xdp_adjust_tail(ctx, (int)action->snaplen - (int)state.size) == 0)
+			truncated = state.size - action->snaplen;
+	}
+	if ((action->flags & (VLAN_ACTION_TAG_PUSH | VLAN_ACTION_TAG_REWRITE | VLAN_ACTION_TAG_STRIP))
+		&& apply_tag(ctx, action->flags, action->tag_vid) < 0)
+		return drop(&state);
+	if (action->tunnel && apply_encap(ctx, action->tunnel, state.vlan_id) < 0)
+		return drop(&state);
+	return redirect(action, &state, truncated);
 }
 
 char _license[] SEC("license") = "GPL";
\ No newline at end of file